@@ -4,17 +4,25 @@ in vec3 FragPosition;
 
 out vec4 FragColor;
 
-uniform vec3 lightDirection;
-uniform vec3 cameraPos;
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
 
-uniform vec3 skyColor;
 uniform vec3 terrainColor;
 //uniform float doTexture;
 
-uniform float doFog;
-uniform float fogDensity;
 
-uniform float useWire;
 uniform vec3 inColor;
 
 uniform sampler2D overlayTexture;
@@ -24,7 +32,6 @@ uniform float textureWidth;
 uniform float textureHeight;
 uniform float tileWidth;
 
-uniform float yScale;
 uniform float zoom;
 
 uniform vec2 tileKey;
@@ -3,9 +3,21 @@ layout (location = 0) in vec2 aPos;
 
 out vec3 FragPosition;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
+
 uniform vec2 offset;
 uniform sampler2D heightmapTexture;
 uniform float textureWidth;
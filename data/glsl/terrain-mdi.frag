@@ -0,0 +1,82 @@
+#version 430 core
+
+in vec3 FragPosition;
+in vec3 FragPos2;
+
+in vec2 inTexCoords;
+in vec3 inNormal;
+flat in vec4 overlayRect; /* Offset (xy) and scale (zw) into the overlay, which may be an ancestor's */
+flat in int overlayLayer;
+flat in float zoom;
+
+out vec4 FragColor;
+
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
+
+uniform sampler2DArray overlayTexture;
+
+float calculateFog(float density);
+vec3 calculateAmbient(vec3 lightColor, float strength);
+vec3 wireframeColor();
+
+void main()
+{
+    vec3 color;
+    vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
+
+   if (useWire < 0.5f) {
+       if (overlayRect.z > 0.0f)
+           color = texture(overlayTexture, vec3(overlayRect.xy + inTexCoords * overlayRect.zw, overlayLayer)).rgb;
+       else
+           color = vec3(0.5f); /* No overlay loaded yet */
+
+       vec3 ambient = calculateAmbient(lightColor, 0.1f);
+
+       if (doFog > 0.5) {
+           vec3 fogColour = vec3(97, 154, 232) / 255.0f;
+           float fogFactor = calculateFog(fogDensity);
+           color = mix(fogColour, color, fogFactor);
+       }
+
+    } else {
+        color = wireframeColor();
+    }
+    FragColor = vec4(color, 1.0f);
+}
+
+vec3 calculateAmbient(vec3 lightColor, float strength) {
+    return strength * lightColor;
+}
+
+/* Same colors as set per node on the regular path */
+vec3 wireframeColor() {
+    int level = int(zoom) % 3;
+    if (level == 0) return vec3(1, 0, 0);
+    if (level == 1) return vec3(0, 1, 0);
+    return vec3(0, 0, 1);
+}
+
+/* The distance fog concept is based on the following resource:
+ * https://opengl-notes.readthedocs.io/en/latest/topics/texturing/aliasing.html */
+float calculateFog(float density) {
+    float start = 0.8;
+    float end = 3.5;
+    float dist = length(cameraPos - FragPos2);
+    if (dist < start) return 1.0f;
+    float scale = (dist - start) / (end - start);
+    float fogFactor = pow(scale, 1);
+    return 1.0f - clamp(fogFactor, 0.0f, 0.5f);
+}
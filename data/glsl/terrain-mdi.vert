@@ -0,0 +1,147 @@
+#version 430 core
+layout (location = 0) in vec3 aPos; /* Position (xy) and skirt flag (z) */
+layout (location = 1) in uint drawId; /* Instanced, offset by the base instance */
+
+/* Per node parameters, see TileInstance in terrainmanager.h */
+struct TileInstance {
+    vec4 subRect; /* Offset (xy) and scale (zw) of the drawn part of the tile */
+    vec4 overlayRect; /* Offset (xy) and scale (zw) into the overlay, which may be an ancestor's */
+    vec4 tile; /* Tile key (xy), zoom (z) and mesh side length (w) */
+    ivec4 layers; /* Heightmap (x), overlay (y) and parent heightmap (z) texture array layer */
+    vec4 morph; /* Offset in the parent (xy), side length of the parent's mesh (z) and morph factor (w) */
+};
+
+layout (std430, binding = 0) readonly buffer TileInstances {
+    TileInstance tiles[];
+};
+
+out vec3 FragPosition;
+out vec3 FragPos2;
+
+out vec3 inNormal;
+out vec2 inTexCoords;
+flat out vec4 overlayRect;
+flat out int overlayLayer;
+flat out float zoom;
+
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
+
+uniform sampler2DArray heightmapTexture;
+uniform vec3 globeRadiusSquared;
+
+float calculateHeight(vec3 height);
+float parentHeight(vec2 tileCoords, int layer, vec4 parentTile);
+vec2 inverseWebMercator(vec2 mercXY);
+vec3 geodeticSurfaceNormal(vec3 geodetic);
+vec3 geodeticToCartesian(vec3 globeRadiiSquared, vec3 geodetic);
+float pi = 3.1415926538;
+
+precision highp float;
+
+void main()
+{
+    TileInstance instance = tiles[drawId];
+    vec2 tileKey = instance.tile.xy;
+    float tw = instance.tile.w - 1;
+
+    /* Normalized positions [0,1] */
+    vec2 aPos1 = vec2((aPos.x + 0.5f * tw) / tw,
+                        (aPos.y + 0.5f * tw) / tw);
+    aPos1 = instance.subRect.xy + aPos1 * instance.subRect.zw;
+
+    float mercX = (tileKey.x + aPos1.x) / float(1 << int(instance.tile.z));
+    float mercY = (tileKey.y + aPos1.y) / float(1 << int(instance.tile.z));
+
+    vec3 height = texture(heightmapTexture, vec3(aPos1, instance.layers.x)).rgb * 255;
+
+    float y = calculateHeight(height);
+
+    /* Right after the parent was split the node looks like the parent */
+    if (instance.morph.w < 1.0f)
+        y = mix(parentHeight(aPos1, instance.layers.z, instance.morph), y, instance.morph.w);
+
+    /* Skirt vertices are lowered below the border of the tile */
+    if (aPos.z > 0.5f) y -= 0.3;
+
+    vec2 lonlat = inverseWebMercator(vec2(mercX, mercY));
+    vec3 spherePos = geodeticToCartesian(globeRadiusSquared, vec3(lonlat.x, y, lonlat.y));
+
+    inTexCoords = aPos1;
+    inNormal = geodeticSurfaceNormal(vec3(lonlat.x, 0, lonlat.y));
+    overlayRect = instance.overlayRect;
+    overlayLayer = instance.layers.y;
+    zoom = instance.tile.z;
+
+    gl_Position = projection * view * model * vec4(spherePos, 1.0);
+
+    FragPos2 = spherePos;
+    FragPosition = FragPos2;
+}
+
+vec3 geodeticSurfaceNormal(vec3 geodetic) {
+    float cosLat = cos(geodetic.z);
+
+    return vec3(cosLat * cos(geodetic.x), sin(geodetic.z), cosLat * sin(geodetic.x));
+}
+
+
+vec3 geodeticToCartesian(vec3 globeRadiiSquared, vec3 geodetic) {
+    vec3 n = geodeticSurfaceNormal(geodetic);
+    vec3 k = globeRadiiSquared * n;
+    float gamma = sqrt(k.x * n.x + k.y * n.y + k.z * n.z);
+
+    vec3 rSurface = k / gamma;
+    return rSurface + (geodetic.y * n);
+}
+
+vec2 inverseWebMercator(vec2 mercXY) {
+
+    float lon = (mercXY.x * 360.0f - 180.0f) * -1;
+    float lat = atan(exp(pi * (1.0f - 2.0f * mercXY.y))) * 2.0f - pi / 2.0f;
+    lat = lat * 180.0f / pi;
+
+    float latRad = radians(lat);
+    float lonRad = radians(lon);
+
+    return vec2(lonRad, latRad);
+
+}
+
+float calculateHeight(vec3 height) {
+    /* Maptiler Terrain RGB decoding formula:
+     *
+     *       elevation = -10000 + ((R * 256 * 256 + G * 256 + B) * 0.1)
+     */
+    float y = -10000 + (((height.r * 256.0f * 256.0f * 0.1) + (height.g * 256.0f * 0.1) + (height.b * 0.1)));
+    return (y / 20169.51); /* Scaling down the Earth radius */
+}
+
+/* Height of the parent's mesh below a position of the node. The parent's grid
+ * vertices are interpolated bilinearly, which is close to how its triangles
+ * are rasterized. */
+float parentHeight(vec2 tileCoords, int layer, vec4 parentTile) {
+    float ptw = parentTile.z - 1;
+    vec2 grid = (parentTile.xy + 0.5f * tileCoords) * ptw;
+    vec2 cell = floor(grid);
+    vec2 f = grid - cell;
+
+    float h00 = calculateHeight(texture(heightmapTexture, vec3(cell / ptw, layer)).rgb * 255);
+    float h10 = calculateHeight(texture(heightmapTexture, vec3((cell + vec2(1, 0)) / ptw, layer)).rgb * 255);
+    float h01 = calculateHeight(texture(heightmapTexture, vec3((cell + vec2(0, 1)) / ptw, layer)).rgb * 255);
+    float h11 = calculateHeight(texture(heightmapTexture, vec3((cell + vec2(1, 1)) / ptw, layer)).rgb * 255);
+
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
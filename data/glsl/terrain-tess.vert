@@ -1,25 +1,31 @@
 #version 400 core
-layout (location = 0) in vec3 aPos;
-
-out vec3 FragPosition;
-out vec3 FragPos2;
-
-//out vec2 lonlat;
-//out vec2 mercXZ;
-//out vec2 globalNormalizedXZ;
-out vec2 inTexCoords;
-out vec3 inNormal;
-
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
-uniform vec2 offset;
-uniform sampler2D heightmapTexture;
-uniform float textureWidth;
-uniform float textureHeight;
-uniform float tileWidth;
+layout (location = 0) in vec3 aPos; /* Normalized position (xy) and skirt flag (z) of the patch corner */
+
+/* Position of the corner on the terrain, only used for choosing the
+ * tessellation levels */
+out vec3 controlPosition;
+out vec3 controlTileCoords; /* Position in the drawn part of the tile (xy) and skirt flag (z) */
+
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
+
+uniform sampler2DArray heightmapTexture;
+uniform int heightmapLayer;
 uniform float zoom;
 uniform vec2 tileKey;
+uniform vec4 subRect; /* Offset (xy) and scale (zw) of the drawn part of the tile */
 uniform vec3 globeRadiusSquared;
 
 float calculateHeight(vec3 height);
@@ -28,40 +34,22 @@ vec3 geodeticSurfaceNormal(vec3 geodetic);
 vec3 geodeticToCartesian(vec3 globeRadiiSquared, vec3 geodetic);
 float pi = 3.1415926538;
 
+precision highp float;
+
 void main()
 {
-
-    float tw = tileWidth;
-
-    tw -=1;
-
-    /* Normalized position */
-    vec2 aPos1 = vec2((aPos.x + 0.5f * tw) / tw,
-                        (aPos.y + 0.5f * tw) / tw);
+    vec2 aPos1 = subRect.xy + aPos.xy * subRect.zw;
 
     float mercX = (tileKey.x + aPos1.x) / float(1 << int(zoom));
     float mercY = (tileKey.y + aPos1.y) / float(1 << int(zoom));
 
-    vec3 height = texture(heightmapTexture, aPos1).rgb * 255;
-
-    float y = calculateHeight(height);
-
-    /* Check if current vertex is the "duplicate" vertex for constructing
-     * the skirt and subtract height if so */
-    if (int(aPos.z) == 1) y -= 0.3;
+    vec3 height = texture(heightmapTexture, vec3(aPos1, heightmapLayer)).rgb * 255;
+    float y = calculateHeight(height) - 0.3 * aPos.z;
 
     vec2 lonlat = inverseWebMercator(vec2(mercX, mercY));
 
-    vec3 spherePos = geodeticToCartesian(globeRadiusSquared, vec3(lonlat.x, y, lonlat.y));
-
-    inTexCoords = aPos1;
-    inNormal = geodeticSurfaceNormal(vec3(lonlat.x, y, lonlat.y));
-
-    gl_Position = projection * view * model * vec4(spherePos, 1.0);
-
-    FragPos2 = spherePos;
-    FragPosition = FragPos2;
-
+    controlPosition = (model * vec4(geodeticToCartesian(globeRadiusSquared, vec3(lonlat.x, y, lonlat.y)), 1.0)).xyz;
+    controlTileCoords = aPos;
 }
 
 vec3 geodeticSurfaceNormal(vec3 geodetic) {
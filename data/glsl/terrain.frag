@@ -11,21 +11,29 @@ in vec3 inNormal;
 
 out vec4 FragColor;
 
-uniform vec3 lightDirection;
-uniform vec3 cameraPos;
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
 
-uniform vec3 skyColor;
 uniform vec3 terrainColor;
-uniform float doFog;
-uniform float fogDensity;
-uniform float useWire;
 uniform vec3 inColor;
-uniform sampler2D overlayTexture;
-uniform sampler2D heightmapTexture;
+uniform sampler2DArray overlayTexture;
+uniform int overlayLayer;
+uniform vec4 overlayRect; /* Offset (xy) and scale (zw) into the overlay, which may be an ancestor's */
 uniform float textureWidth;
 uniform float textureHeight;
 uniform float tileWidth;
-uniform float yScale;
 uniform float zoom;
 
 uniform vec2 tileKey;
@@ -42,7 +50,10 @@ void main()
     vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
 
    if (useWire < 0.5f) {
-       color = texture(overlayTexture, inTexCoords).rgb;
+       if (overlayRect.z > 0.0f)
+           color = texture(overlayTexture, vec3(overlayRect.xy + inTexCoords * overlayRect.zw, overlayLayer)).rgb;
+       else
+           color = vec3(0.5f); /* No overlay loaded yet */
 
        vec3 ambient = calculateAmbient(lightColor, 0.1f);
 
@@ -1,5 +1,5 @@
 #version 400 core
-layout (location = 0) in vec2 aPos;
+layout (location = 0) in vec3 aPos; /* Position (xy) and skirt flag (z) */
 
 out vec3 FragPosition;
 out vec3 FragPos2;
@@ -10,19 +10,36 @@ out vec3 FragPos2;
 out vec3 inNormal;
 out vec2 inTexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+/* Per frame globals shared by all terrain shaders, see GlobalUniforms in
+ * terrainmanager.h */
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    mat4 model;
+    vec3 cameraPos;
+    float fogDensity;
+    vec3 lightDirection;
+    float doFog;
+    vec3 skyColor;
+    float yScale;
+    float useWire;
+};
+
 uniform vec2 offset;
-uniform sampler2D heightmapTexture;
+uniform sampler2DArray heightmapTexture;
+uniform int heightmapLayer;
 uniform float textureWidth;
 uniform float textureHeight;
 uniform float tileWidth;
 uniform float zoom;
 uniform vec2 tileKey;
+uniform vec4 subRect; /* Offset (xy) and scale (zw) of the drawn part of the tile */
+uniform int parentHeightmapLayer;
+uniform vec4 morph; /* Offset in the parent (xy), side length of the parent's mesh (z) and morph factor (w) */
 uniform vec3 globeRadiusSquared;
 
 float calculateHeight(vec3 height);
+float parentHeight(vec2 tileCoords, int layer, vec4 parentTile);
 vec2 inverseWebMercator(vec2 mercXY);
 vec3 geodeticSurfaceNormal(vec3 geodetic);
 vec3 geodeticToCartesian(vec3 globeRadiiSquared, vec3 geodetic);
@@ -37,14 +54,22 @@ void main()
     /* Normalized positions [0,1] */
     vec2 aPos1 = vec2((aPos.x + 0.5f * tw) / tw,
                         (aPos.y + 0.5f * tw) / tw);
+    aPos1 = subRect.xy + aPos1 * subRect.zw;
 
     float mercX = (tileKey.x + aPos1.x) / float(1 << int(zoom));
     float mercY = (tileKey.y + aPos1.y) / float(1 << int(zoom));
 
-    vec3 height = texture(heightmapTexture, aPos1).rgb * 255;
+    vec3 height = texture(heightmapTexture, vec3(aPos1, heightmapLayer)).rgb * 255;
 
     float y = calculateHeight(height);
 
+    /* Right after the parent was split the node looks like the parent */
+    if (morph.w < 1.0f)
+        y = mix(parentHeight(aPos1, parentHeightmapLayer, morph), y, morph.w);
+
+    /* Skirt vertices are lowered below the border of the tile */
+    if (aPos.z > 0.5f) y -= 0.3;
+
     vec2 lonlat = inverseWebMercator(vec2(mercX, mercY));
     vec3 spherePos = geodeticToCartesian(globeRadiusSquared, vec3(lonlat.x, y, lonlat.y));
 
@@ -95,3 +120,19 @@ float calculateHeight(vec3 height) {
     return (y / 20169.51); /* Scaling down the Earth radius */
 }
 
+/* Height of the parent's mesh below a position of the node. The parent's grid
+ * vertices are interpolated bilinearly, which is close to how its triangles
+ * are rasterized. */
+float parentHeight(vec2 tileCoords, int layer, vec4 parentTile) {
+    float ptw = parentTile.z - 1;
+    vec2 grid = (parentTile.xy + 0.5f * tileCoords) * ptw;
+    vec2 cell = floor(grid);
+    vec2 f = grid - cell;
+
+    float h00 = calculateHeight(texture(heightmapTexture, vec3(cell / ptw, layer)).rgb * 255);
+    float h10 = calculateHeight(texture(heightmapTexture, vec3((cell + vec2(1, 0)) / ptw, layer)).rgb * 255);
+    float h01 = calculateHeight(texture(heightmapTexture, vec3((cell + vec2(0, 1)) / ptw, layer)).rgb * 255);
+    float h11 = calculateHeight(texture(heightmapTexture, vec3((cell + vec2(1, 1)) / ptw, layer)).rgb * 255);
+
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
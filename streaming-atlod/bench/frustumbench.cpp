@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "camera.h"
+#include "frustumculling.h"
+
+/**
+ * Micro benchmark comparing the frustum culling paths: the previous
+ * per node test (frustum copied by value, all six planes evaluated), the
+ * scalar test with early-out and the batched test of four boxes at once.
+ */
+
+namespace {
+
+const unsigned NUM_BATCHES = 4096;
+const unsigned REPETITIONS = 200;
+
+struct Box {
+    glm::vec3 p1, p2;
+};
+
+/**
+ * @brief legacyCheckPlane The plane test as it was before the batched path
+ */
+bool legacyCheckPlane(Plane& plane, glm::vec3 p1, glm::vec3 p2)
+{
+    glm::vec3 aabbCenter = p1 + ((p2 - p1) / 2.0f);
+    float r = (p2.x - p1.x) / 2.0f * std::abs(plane.normal.x)
+        + (p2.y - p1.y) / 2.0f * std::abs(plane.normal.y)
+        + (p2.z - p1.z) / 2.0f * std::abs(plane.normal.z);
+
+    return -r <= plane.getSignedDistanceToPlane(aabbCenter);
+}
+
+bool legacyInsideViewFrustum(Frustum frustum, glm::vec3 p1, glm::vec3 p2)
+{
+    unsigned checked = 0;
+
+    checked += legacyCheckPlane(frustum.leftFace, p1, p2);
+    checked += legacyCheckPlane(frustum.rightFace, p1, p2);
+    checked += legacyCheckPlane(frustum.topFace, p1, p2);
+    checked += legacyCheckPlane(frustum.bottomFace, p1, p2);
+    checked += legacyCheckPlane(frustum.nearFace, p1, p2);
+    checked += legacyCheckPlane(frustum.farFace, p1, p2);
+
+    return checked == 6;
+}
+
+/**
+ * @brief makeFrustum Same construction as Camera::updateFrustum
+ */
+Frustum makeFrustum(glm::vec3 position, glm::vec3 front, glm::vec3 up, float fovY, float aspectRatio, float zNear, float zFar)
+{
+    glm::vec3 right = glm::normalize(glm::cross(front, up));
+    const float halfVSide = zFar * std::tan(fovY * 0.5f);
+    const float halfHSide = halfVSide * aspectRatio;
+    const glm::vec3 frontMultFar = zFar * front;
+
+    Frustum frustum;
+    frustum.nearFace = { position + zNear * front, front };
+    frustum.farFace = { position + frontMultFar, -front };
+    frustum.rightFace = { position, glm::cross(frontMultFar - right * halfHSide, up) };
+    frustum.leftFace = { position, glm::cross(up, frontMultFar + right * halfHSide) };
+    frustum.topFace = { position, glm::cross(right, frontMultFar - up * halfVSide) };
+    frustum.bottomFace = { position, glm::cross(frontMultFar + up * halfVSide, right) };
+    return frustum;
+}
+
+template <typename F>
+double culledPerMicrosecond(F cull, uint64_t& visible)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned r = 0; r < REPETITIONS; r++)
+        visible += cull();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double us = std::chrono::duration<double, std::micro>(end - start).count();
+    return (double)NUM_BATCHES * 4 * REPETITIONS / us;
+}
+
+}
+
+int main()
+{
+    /* Camera close to the globe surface, looking at the horizon */
+    Frustum frustum = makeFrustum(glm::vec3(320.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+        0.785f, 16.0f / 9.0f, 0.01f, 1300.0f);
+
+    /* Boxes of varying size scattered around the camera */
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-400.0f, 400.0f);
+    std::uniform_real_distribution<float> size(0.01f, 20.0f);
+
+    std::vector<Box> boxes(NUM_BATCHES * 4);
+    std::vector<AABBBatch> batches(NUM_BATCHES);
+
+    for (unsigned i = 0; i < boxes.size(); i++) {
+        glm::vec3 p1(position(rng), position(rng), position(rng));
+        glm::vec3 p2 = p1 + glm::vec3(size(rng), size(rng), size(rng));
+        boxes[i] = { p1, p2 };
+        batches[i / 4].set(i % 4, p1, p2);
+    }
+
+    uint64_t visibleLegacy = 0, visibleScalar = 0, visibleBatch = 0;
+
+    double legacy = culledPerMicrosecond([&]() {
+        unsigned visible = 0;
+        for (const Box& box : boxes)
+            visible += legacyInsideViewFrustum(frustum, box.p1, box.p2);
+        return visible;
+    },
+        visibleLegacy);
+
+    double scalar = culledPerMicrosecond([&]() {
+        unsigned visible = 0;
+        for (const Box& box : boxes)
+            visible += FrustumCulling::insideFrustum(frustum, (box.p1 + box.p2) * 0.5f, (box.p2 - box.p1) * 0.5f);
+        return visible;
+    },
+        visibleScalar);
+
+    double batch = culledPerMicrosecond([&]() {
+        unsigned visible = 0;
+        for (const AABBBatch& b : batches) {
+            unsigned mask = FrustumCulling::cullBatch(frustum, b);
+            visible += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+        }
+        return visible;
+    },
+        visibleBatch);
+
+    std::cout << "Legacy per box:   " << legacy << " culls/us" << std::endl;
+    std::cout << "Scalar early-out: " << scalar << " culls/us" << std::endl;
+    std::cout << "Batch of four:    " << batch << " culls/us" << std::endl;
+
+    if (visibleLegacy != visibleScalar || visibleLegacy != visibleBatch)
+        std::cout << "Mismatch in visible boxes!" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+#include "gridmesh.h"
+
+/**
+ * Offline estimate of the vertex shader invocations per tile. The post
+ * transform cache is simulated as a FIFO of the given size, which is how
+ * older GPUs worked and a conservative model for newer ones. Compares the
+ * previous row-major triangle strips with the stripe-ordered triangle lists
+ * of GridMesh::generateIndices.
+ *
+ * The real invocations are shown in the sidebar if the driver supports
+ * ARB_pipeline_statistics_query.
+ */
+
+namespace {
+
+const unsigned RESTART = ~0u;
+
+/**
+ * @brief legacyStripIndices The grid and skirt strips as they were before
+ *        the triangle lists
+ */
+std::vector<unsigned> legacyStripIndices(unsigned sideLength)
+{
+    std::vector<unsigned> indices;
+
+    for (unsigned i = 0; i < sideLength - 1; i++) {
+        for (unsigned j = 0; j < sideLength; j++) {
+            indices.push_back(j + sideLength * i);
+            indices.push_back(j + sideLength * (i + 1));
+        }
+        indices.push_back(RESTART);
+    }
+
+    std::vector<unsigned> border = GridMesh::borderIndices(sideLength);
+    unsigned firstSkirtVertex = sideLength * sideLength;
+
+    for (unsigned k = 0; k < border.size(); k++) {
+        indices.push_back(firstSkirtVertex + k);
+        indices.push_back(border[k]);
+    }
+    indices.push_back(firstSkirtVertex);
+    indices.push_back(border[0]);
+
+    return indices;
+}
+
+/**
+ * @brief simulateFifo
+ * @return Number of cache misses, i.e. vertex shader invocations
+ */
+unsigned simulateFifo(const std::vector<unsigned>& indices, unsigned cacheSize)
+{
+    std::deque<unsigned> cache;
+    unsigned misses = 0;
+
+    for (unsigned index : indices) {
+        if (index == RESTART)
+            continue;
+
+        if (std::find(cache.begin(), cache.end(), index) != cache.end())
+            continue;
+
+        misses++;
+        cache.push_back(index);
+        if (cache.size() > cacheSize)
+            cache.pop_front();
+    }
+
+    return misses;
+}
+
+void compare(unsigned sideLength, unsigned cacheSize)
+{
+    unsigned vertices = sideLength * sideLength + 4 * (sideLength - 1);
+    unsigned triangles = (sideLength - 1) * (sideLength - 1) * 2 + 4 * (sideLength - 1) * 2;
+
+    unsigned strips = simulateFifo(legacyStripIndices(sideLength), cacheSize);
+    unsigned lists = simulateFifo(GridMesh::generateIndices(sideLength), cacheSize);
+
+    std::cout << "side " << sideLength << ", FIFO " << cacheSize << ": "
+              << vertices << " vertices, "
+              << "strips " << strips << " invocations (ACMR " << (double)strips / triangles << "), "
+              << "stripes " << lists << " invocations (ACMR " << (double)lists / triangles << ")"
+              << std::endl;
+}
+
+}
+
+int main()
+{
+    /* Default mesh resolutions of the config */
+    for (unsigned cacheSize : { 16u, 32u }) {
+        compare(16, cacheSize);
+        compare(32, cacheSize);
+        compare(64, cacheSize);
+    }
+
+    return 0;
+}
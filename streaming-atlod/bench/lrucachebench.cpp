@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "flatlrucache.h"
+#include "lrucache.h"
+#include "xyztilekey.h"
+
+/**
+ * Micro benchmark comparing LRUCache and FlatLRUCache with the access
+ * pattern of the terrain traversal: every frame a window of tiles is looked
+ * up (get and contains of the children), and the window slowly slides over
+ * the key space, so that new tiles are inserted and old ones evicted.
+ *
+ * FlatLRUCache only approximates the LRU order (see its class comment), so
+ * the hit rates are printed to compare the quality of the eviction too.
+ */
+
+namespace {
+
+const unsigned FRAMES = 2000;
+
+/**
+ * @brief makeKeys Creates a pool of distinct tile keys at zoom level 16
+ * @param count
+ * @return
+ */
+std::vector<XYZTileKey> makeKeys(unsigned count)
+{
+    std::vector<XYZTileKey> keys;
+    keys.reserve(count);
+
+    unsigned side = 1;
+    while (side * side < count)
+        side++;
+
+    for (unsigned i = 0; i < count; i++)
+        keys.emplace_back(30000 + i % side, 20000 + i / side, 16);
+
+    return keys;
+}
+
+template <typename Cache>
+double run(unsigned capacity, const std::vector<XYZTileKey>& keys, uint64_t& hits)
+{
+    Cache cache(capacity);
+
+    /* The visible window is smaller than the cache, like the visible set is
+     * smaller than the memory cache */
+    unsigned window = capacity * 3 / 4;
+    unsigned step = capacity / 50 + 1;
+    uint64_t operations = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (unsigned frame = 0; frame < FRAMES; frame++) {
+        unsigned offset = (frame * step) % (keys.size() - window);
+
+        for (unsigned i = 0; i < window; i++) {
+            const XYZTileKey& key = keys[offset + i];
+
+            if (!cache.contains(key)) {
+                cache.put(key, i);
+            } else {
+                cache.get(key);
+                hits++;
+            }
+
+            cache.contains(key.topLeftChild());
+            operations += 3;
+        }
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / operations;
+}
+
+void compare(unsigned capacity)
+{
+    std::vector<XYZTileKey> keys = makeKeys(capacity * 8);
+    uint64_t hitsList = 0;
+    uint64_t hitsFlat = 0;
+
+    double list = run<LRUCache<XYZTileKey, unsigned>>(capacity, keys, hitsList);
+    double flat = run<FlatLRUCache<XYZTileKey, unsigned>>(capacity, keys, hitsFlat);
+
+    double lookups = (double)FRAMES * (capacity * 3 / 4);
+
+    std::cout << "capacity " << capacity << ": "
+              << "LRUCache " << list << " ns/op (hit rate " << hitsList / lookups << "), "
+              << "FlatLRUCache " << flat << " ns/op (hit rate " << hitsFlat / lookups << "), "
+              << "speedup " << list / flat << "x" << std::endl;
+}
+
+}
+
+int main()
+{
+    /* Typical memory and disk cache sizes */
+    compare(500);
+    compare(8000);
+
+    return 0;
+}
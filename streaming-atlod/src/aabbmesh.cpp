@@ -1,5 +1,6 @@
 #include "aabbmesh.h"
 
+#include "glstatecache.h"
 #include "util.h"
 #include <iostream>
 
@@ -17,9 +18,8 @@ void AABBMesh::load()
 void AABBMesh::render()
 {
     glDisable(GL_CULL_FACE);
-    glBindVertexArray(_vao);
+    GlStateCache::getInstance()->bindVertexArray(_vao);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
     glEnable(GL_CULL_FACE);
 }
 
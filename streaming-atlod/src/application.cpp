@@ -97,10 +97,25 @@ void showSidebar()
 
     if (ImGui::Begin("Sidebar", nullptr, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove)) {
         ImGui::Text("Draw calls: %d", globalRenderStats.drawCalls);
+        ImGui::Text("Terrain submit time: %d us", globalRenderStats.submitMicros);
+        ImGui::Text("Redundant GL state changes filtered: %d", globalRenderStats.filteredStateChanges);
+        ImGui::Text("Multi-draw indirect: %s", globalRenderStats.multiDrawIndirect ? "yes" : "no");
         ImGui::Text("Rendered triangles: %d", globalRenderStats.renderedTriangles);
+        if (globalRenderStats.pipelineStatistics)
+            ImGui::Text("Terrain vertex shader invocations: %d", globalRenderStats.vertexShaderInvocations);
         ImGui::Text("Number of visible nodes: %d", globalRenderStats.visibleNodes);
         ImGui::Text("Number of traversed nodes: %d", globalRenderStats.traversedNodes);
+        ImGui::Text("Reused subtrees of the LOD cut: %d", globalRenderStats.reusedSubtrees);
+        ImGui::Text("LOD cut update time: %d us", globalRenderStats.traversalMicros);
+        ImGui::Text("Frustum plane tests saved: %d", globalRenderStats.planeTestsSaved);
+        ImGui::Text("Memoized LOD decisions: %d", globalRenderStats.memoizedDecisions);
+        ImGui::Text("LOD cut reused: %s", globalRenderStats.lodCutReused ? "true" : "false");
+        ImGui::Text("Traversal tasks: %d", globalRenderStats.traversalTasks);
+        ImGui::Text("Children culled before loading: %d", globalRenderStats.culledChildren);
+        ImGui::Text("Skip-level requests: %d", globalRenderStats.skipLevelRequests);
         ImGui::Text("Number of requested nodes: %d", globalRenderStats.currentlyRequested);
+        ImGui::Text("Texture uploads in flight: %d", globalRenderStats.pendingUploads);
+        ImGui::Text("Loaded tiles waiting for integration: %d", globalRenderStats.integrationBacklog);
         ImGui::Text("Number of allocated nodes: %d", globalRenderStats.numberOfNodes);
         ImGui::Text("Number of nodes in the disk cache: %d", globalRenderStats.numberOfDiskCacheEntries);
         ImGui::Text("Offline wait: %s", globalRenderStats.waitOffline ? "true" : "false");
@@ -108,6 +123,7 @@ void showSidebar()
         ImGui::Text("API requests: %d", globalRenderStats.apiRequests);
         ImGui::Text("Mem. for overlay & heightmap\ntextures: %.2f MB", (float)globalRenderStats.numberOfNodes * ((512 * 512 * 3) + (512 * 512 * 3 * 1.33)) / 1000000.0f);
         ImGui::Text("Deepest level: %d", globalRenderStats.deepestZoomLevel);
+        ImGui::SliderFloat("Pixel tolerance", &terrainManager->_pixelTolerance, 0.5f, 16.0f);
         ImGui::Text("Cam pos (WS): (%.2f, %.2f, %.2f)", camera.position().x, camera.position().y, camera.position().z);
         ImGui::Text("Cam front: (%.2f, %.2f, %.2f)", camera.front().x, camera.front().y, camera.front().z);
         ImGui::Text("Cam up: (%.2f, %.2f, %.2f)", camera.up().x, camera.up().y, camera.up().z);
@@ -141,10 +157,14 @@ void setup()
 {
     welcome();
     setupCurl();
+
+    /* The config decides which OpenGL version to request */
+    ConfigManager::getInstance()->loadConfig(configPath);
+
     setupGlfw();
     setupImGui();
 
-    ConfigManager::getInstance()->loadConfig(configPath);
+    camera.viewportHeight((float)windowHeight);
 }
 
 /**
@@ -154,7 +174,7 @@ void setupGlfw()
 {
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, ConfigManager::getInstance()->multiDrawIndirect() ? 3 : 1);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
@@ -163,6 +183,13 @@ void setupGlfw()
 
     window = glfwCreateWindow(windowWidth, windowHeight, "StreamingATLOD", NULL, NULL);
 
+    /* Multi-draw indirect needs OpenGL 4.3, the terrain manager falls back
+     * to one draw call per node with an older context */
+    if (window == NULL && ConfigManager::getInstance()->multiDrawIndirect()) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        window = glfwCreateWindow(windowWidth, windowHeight, "StreamingATLOD", NULL, NULL);
+    }
+
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -216,7 +243,7 @@ void run()
     skybox->loadBuffers();
     skybox->loadTexture(ConfigManager::getInstance()->dataPath() + "skybox/" + skyboxFolderName + "/");
 
-    terrainManager = new TerrainManager(globalRenderStats, 16, 32, 32, 400, 2000);
+    terrainManager = new TerrainManager(globalRenderStats);
     terrainManager->setup();
 
     while (!glfwWindowShouldClose(window)) {
@@ -302,41 +329,18 @@ void updateGlobalUniforms()
     glm::mat4 view = camera.getViewMatrix();
     glm::mat4 model = glm::mat4(1.0f);
 
-    terrainManager->_terrainShader.use();
-    terrainManager->_terrainShader.setMat4("projection", projection);
-    terrainManager->_terrainShader.setMat4("view", view);
-    terrainManager->_terrainShader.setVec3("cameraPos", lastCam.position());
-    terrainManager->_terrainShader.setVec3("lightDirection", lightDirection);
-    terrainManager->_terrainShader.setVec3("skyColor", skyColor);
-    terrainManager->_terrainShader.setFloat("fogDensity", fogDensity);
-    terrainManager->_terrainShader.setFloat("doFog", (float)doFog);
-    terrainManager->_terrainShader.setFloat("yScale", yScale);
-    terrainManager->_terrainShader.setMat4("model", model);
-    terrainManager->_terrainShader.setFloat("useWire", (float)doWire);
-
-    terrainManager->_skirtShader.use();
-    terrainManager->_skirtShader.setMat4("projection", projection);
-    terrainManager->_skirtShader.setMat4("view", view);
-    terrainManager->_skirtShader.setVec3("cameraPos", lastCam.position());
-    terrainManager->_skirtShader.setVec3("lightDirection", lightDirection);
-    terrainManager->_skirtShader.setVec3("skyColor", skyColor);
-    terrainManager->_skirtShader.setFloat("fogDensity", fogDensity);
-    terrainManager->_skirtShader.setFloat("doFog", (float)doFog);
-    terrainManager->_skirtShader.setFloat("yScale", yScale);
-    terrainManager->_skirtShader.setMat4("model", model);
-    terrainManager->_skirtShader.setFloat("useWire", (float)doWire);
-
-    terrainManager->_poleShader.use();
-    terrainManager->_poleShader.setMat4("projection", projection);
-    terrainManager->_poleShader.setMat4("view", view);
-    terrainManager->_poleShader.setVec3("cameraPos", lastCam.position());
-    terrainManager->_poleShader.setVec3("lightDirection", lightDirection);
-    terrainManager->_poleShader.setVec3("skyColor", skyColor);
-    terrainManager->_poleShader.setFloat("fogDensity", fogDensity);
-    terrainManager->_poleShader.setFloat("doFog", (float)doFog);
-    terrainManager->_poleShader.setFloat("yScale", yScale);
-    terrainManager->_poleShader.setMat4("model", model);
-    terrainManager->_poleShader.setFloat("useWire", (float)doWire);
+    GlobalUniforms globals;
+    globals.projection = projection;
+    globals.view = view;
+    globals.model = model;
+    globals.cameraPos = lastCam.position();
+    globals.fogDensity = fogDensity;
+    globals.lightDirection = lightDirection;
+    globals.doFog = (float)doFog;
+    globals.skyColor = skyColor;
+    globals.yScale = yScale;
+    globals.useWire = (float)doWire;
+    terrainManager->updateGlobals(globals);
 
     terrainManager->_aabbShader.use();
     terrainManager->_aabbShader.setMat4("projection", projection);
@@ -471,6 +475,7 @@ void framebufferSizeCallback(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
     camera.aspectRatio((float)width / (float)height);
+    camera.viewportHeight((float)height);
     camera.updateCameraVectors();
 }
 
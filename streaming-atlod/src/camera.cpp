@@ -1,4 +1,5 @@
 #include "camera.h"
+#include "frustumculling.h"
 #include "mapprojections.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -47,38 +48,14 @@ void Camera::aspectRatio(float aspectRatio)
     _aspectRatio = aspectRatio;
 }
 
-bool Camera::insideViewFrustum(glm::vec3 p1, glm::vec3 p2)
+float Camera::aspectRatio()
 {
-    Frustum frustum = _viewFrustum;
-
-    unsigned checked = 0;
-
-    checked += checkPlane(frustum.leftFace, p1, p2);
-    checked += checkPlane(frustum.rightFace, p1, p2);
-    checked += checkPlane(frustum.topFace, p1, p2);
-    checked += checkPlane(frustum.bottomFace, p1, p2);
-    checked += checkPlane(frustum.nearFace, p1, p2);
-    checked += checkPlane(frustum.farFace, p1, p2);
-
-    return checked == 6;
+    return _aspectRatio;
 }
 
-bool Camera::checkPlane(Plane& plane, glm::vec3 p1, glm::vec3 p2)
+bool Camera::insideViewFrustum(const glm::vec3& p1, const glm::vec3& p2) const
 {
-    float minY = p1.y;
-    float maxY = p2.y;
-    float width = p2.x - p1.x;
-    float depth = p2.z - p1.z;
-    glm::vec3 aabbCenter = p1 + ((p2 - p1) / 2.0f);
-
-    float halfHeight = (maxY - minY) / 2.0f;
-    float halfBlockWidth = width / 2.0f;
-    float halfBlockDepth = depth / 2.0f;
-    float r = halfBlockWidth * std::abs(plane.normal.x)
-        + halfHeight * std::abs(plane.normal.y)
-        + halfBlockDepth * std::abs(plane.normal.z);
-
-    return -r <= plane.getSignedDistanceToPlane(aabbCenter);
+    return FrustumCulling::insideFrustum(_viewFrustum, (p1 + p2) * 0.5f, (p2 - p1) * 0.5f);
 }
 
 glm::mat4 Camera::getViewMatrix()
@@ -96,6 +73,29 @@ void Camera::zoom(float zoom)
     _zoom = zoom;
 }
 
+float Camera::viewportHeight()
+{
+    return _viewportHeight;
+}
+
+void Camera::viewportHeight(float viewportHeight)
+{
+    _viewportHeight = viewportHeight;
+}
+
+/**
+ * @brief Camera::screenSpaceErrorFactor
+ *
+ * Factor which projects a geometric error at distance 1 to pixels, i.e. an
+ * error e at distance d covers e * factor / d pixels on the screen.
+ *
+ * @return
+ */
+float Camera::screenSpaceErrorFactor()
+{
+    return _viewportHeight / (2.0f * glm::tan(glm::radians(_zoom) / 2.0f));
+}
+
 glm::vec3 Camera::position()
 {
     return _position;
@@ -202,7 +202,7 @@ void Camera::processMouseMovement(float xOffset, float yOffset)
     updateFrustum();
 }
 
-Frustum Camera::viewFrustum()
+const Frustum& Camera::viewFrustum() const
 {
     return _viewFrustum;
 }
@@ -82,19 +82,23 @@ public:
     glm::vec3 right();
     glm::vec3 up();
     glm::vec3 position();
-    Frustum viewFrustum();
+    const Frustum& viewFrustum() const;
     float zoom();
     float yaw();
     float pitch();
+    float viewportHeight();
+    float aspectRatio();
+    float screenSpaceErrorFactor();
 
     /* Setters */
     void aspectRatio(float aspectRatio);
     void yaw(float yaw);
     void pitch(float pitch);
     void zoom(float zoom);
+    void viewportHeight(float viewportHeight);
 
     /* Frustum culling */
-    bool insideViewFrustum(glm::vec3 p1, glm::vec3 p2);
+    bool insideViewFrustum(const glm::vec3& p1, const glm::vec3& p2) const;
 
     /* Automatic flying and 360-look-around methods */
     void lerpFly(float lerpFactor);
@@ -122,9 +126,6 @@ public:
     float verticalCollisionOffset = 0.0;
 
 private:
-    bool
-    checkPlane(Plane& plane, glm::vec3 p1, glm::vec3 p2);
-
     Frustum _viewFrustum;
     glm::vec3 _position;
     glm::vec3 _front;
@@ -134,6 +135,7 @@ private:
     float _zNear;
     float _zFar;
     float _aspectRatio;
+    float _viewportHeight = 720.0f; /* In pixels */
     float _yaw;
     float _pitch;
     float _movementSpeed;
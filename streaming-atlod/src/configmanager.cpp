@@ -52,6 +52,30 @@ bool ConfigManager::addSingleEntry(std::string key, std::string value)
     if (key == "maxzoom") {
         shouldExit |= tryParsingNumber(_maxZoom, value, "Maximum zoom level must be an unsigned integer");
     }
+    if (key == "pixeltolerance") {
+        shouldExit |= tryParsingFloat(_pixelTolerance, value, "Pixel tolerance must be a number");
+    }
+    if (key == "traversalthreads") {
+        shouldExit |= tryParsingNumber(_traversalThreads, value, "Number of traversal threads must be an unsigned integer");
+    }
+    if (key == "traversalforkdepth") {
+        shouldExit |= tryParsingNumber(_traversalForkDepth, value, "Traversal fork depth must be an unsigned integer");
+    }
+    if (key == "skiplevelstride") {
+        shouldExit |= tryParsingNumber(_skipLevelStride, value, "Skip-level stride must be an unsigned integer");
+    }
+    if (key == "integrationbudget") {
+        shouldExit |= tryParsingNumber(_integrationBudget, value, "Integration budget must be an unsigned integer");
+    }
+    if (key == "tessellation") {
+        shouldExit |= tryParsingNumber(_tessellation, value, "Tessellation edge length must be an unsigned integer");
+    }
+    if (key == "morphrange") {
+        shouldExit |= tryParsingFloat(_morphRange, value, "Morph range must be a number");
+    }
+    if (key == "multidrawindirect") {
+        shouldExit |= tryParsingNumber(_multiDrawIndirect, value, "Multi-draw indirect must be 0 or 1");
+    }
 
     return shouldExit;
 }
@@ -68,6 +92,57 @@ bool ConfigManager::tryParsingNumber(int& property, std::string value, std::stri
     }
 }
 
+bool ConfigManager::tryParsingFloat(float& property, std::string value, std::string errorMessage)
+{
+    try {
+        property = std::stof(value);
+        return false;
+    } catch (...) {
+        std::cerr << errorMessage << std::endl;
+        return true;
+    }
+}
+
+float ConfigManager::pixelTolerance() const
+{
+    return _pixelTolerance;
+}
+
+int ConfigManager::traversalThreads() const
+{
+    return _traversalThreads;
+}
+
+int ConfigManager::traversalForkDepth() const
+{
+    return _traversalForkDepth;
+}
+
+int ConfigManager::skipLevelStride() const
+{
+    return _skipLevelStride;
+}
+
+int ConfigManager::integrationBudget() const
+{
+    return _integrationBudget;
+}
+
+int ConfigManager::tessellation() const
+{
+    return _tessellation;
+}
+
+float ConfigManager::morphRange() const
+{
+    return _morphRange;
+}
+
+bool ConfigManager::multiDrawIndirect() const
+{
+    return _multiDrawIndirect == 1;
+}
+
 int ConfigManager::maxZoom() const
 {
     return _maxZoom;
@@ -220,6 +295,46 @@ void ConfigManager::loadConfig(std::string path)
         shouldExit = true;
     }
 
+    if (_pixelTolerance < 0.5f || _pixelTolerance > 16.0f) {
+        std::cerr << "The pixel tolerance must be between 0.5 and 16" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_traversalThreads < 0 || _traversalThreads > 16) {
+        std::cerr << "Number of traversal threads must be between 0 and 16" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_traversalForkDepth < 1 || _traversalForkDepth > 8) {
+        std::cerr << "The traversal fork depth must be between 1 and 8" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_skipLevelStride < 0 || _skipLevelStride > 8) {
+        std::cerr << "The skip-level stride must be between 0 and 8" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_integrationBudget < 0 || _integrationBudget > 100000) {
+        std::cerr << "The integration budget must be between 0 and 100000 microseconds" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_multiDrawIndirect < 0 || _multiDrawIndirect > 1) {
+        std::cerr << "Multi-draw indirect must be 0 or 1" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_tessellation < 0 || _tessellation > 64) {
+        std::cerr << "The tessellation edge length must be between 0 and 64 pixels" << std::endl;
+        shouldExit = true;
+    }
+
+    if (_morphRange < 0.0f || _morphRange > 1.0f) {
+        std::cerr << "The morph range must be between 0 and 1" << std::endl;
+        shouldExit = true;
+    }
+
     if (shouldExit) {
         std::exit(1);
     }
@@ -17,6 +17,7 @@ protected:
     ConfigManager();
     bool addSingleEntry(std::string key, std::string value);
     bool tryParsingNumber(int& property, std::string value, std::string errorMessage);
+    bool tryParsingFloat(float& property, std::string value, std::string errorMessage);
 
     static ConfigManager* _manager;
 
@@ -33,6 +34,14 @@ protected:
     int _highMeshRes = -1;
     int _numLoadWorkers = -1;
     int _maxZoom = -1;
+    float _pixelTolerance = 2.0f; /* Optional */
+    int _traversalThreads = 0; /* Optional, 0 traverses on the render thread only */
+    int _traversalForkDepth = 4; /* Optional */
+    int _skipLevelStride = 0; /* Optional, 0 disables skip-level loading */
+    int _multiDrawIndirect = 0; /* Optional, needs OpenGL 4.3 */
+    int _integrationBudget = 3000; /* Optional, in microseconds, 0 is unlimited */
+    int _tessellation = 0; /* Optional, target edge length in pixels, 0 disables tessellation */
+    float _morphRange = 0.0f; /* Optional, fraction of the split distance, 0 disables geomorphing */
 
 public:
     ConfigManager(ConfigManager& other) = delete;
@@ -55,6 +64,14 @@ public:
     int highMeshRes() const;
     int numLoadWorkers() const;
     int maxZoom() const;
+    float pixelTolerance() const;
+    int traversalThreads() const;
+    int traversalForkDepth() const;
+    int skipLevelStride() const;
+    bool multiDrawIndirect() const;
+    int integrationBudget() const;
+    int tessellation() const;
+    float morphRange() const;
 };
 
 #endif // CONFIGMANAGER_H
@@ -48,10 +48,13 @@ void DiskDeallocationWorkerThread::evictFromDiskCache(DiskDeallocationRequest& r
         + "_" + std::to_string(tileKey.y())
         + "_" + std::to_string(tileKey.z()) + ".webp";
 
-    bool noError = std::filesystem::remove(overlayFileName);
-    noError = noError && std::filesystem::remove(heightmapFileName);
+    /* Tiles whose overlay never arrived only have a heightmap, missing files
+     * are not an error */
+    std::error_code overlayError, heightmapError;
+    std::filesystem::remove(overlayFileName, overlayError);
+    std::filesystem::remove(heightmapFileName, heightmapError);
 
-    if (!noError) {
+    if (overlayError || heightmapError) {
         response.type = UNLOAD_ERROR;
     } else {
         response.type = UNLOAD_OK;
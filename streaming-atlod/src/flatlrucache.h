@@ -0,0 +1,381 @@
+#ifndef FLATLRUCACHE_H
+#define FLATLRUCACHE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "lrucache.h"
+
+/**
+ * @brief The FlatLRUCache class
+ *
+ * Drop-in replacement for LRUCache which does not allocate after
+ * construction. All entries live in one contiguous array which is used as an
+ * open-addressing hash table with linear probing, the recency list is
+ * threaded through the same array as slot indices. The table is kept at most
+ * half full, and erasing uses backward-shift deletion, so no tombstones are
+ * needed.
+ *
+ * Reads do not reorder the recency list. Like in the CLOCK algorithm, they
+ * only set a reference bit on the entry, and referenced entries get a second
+ * chance when they reach the end of the list upon eviction. This keeps
+ * lookups free of pointer updates, at the cost of only approximating the
+ * LRU order among entries read since they were last moved.
+ *
+ * Both the key and the value type must be default constructible and cheap to
+ * copy.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class FlatLRUCache {
+private:
+    static constexpr uint32_t NIL = std::numeric_limits<uint32_t>::max();
+
+    struct Slot {
+        K key;
+        V value;
+        uint32_t prev = NIL; /* Towards the most recently used entry */
+        uint32_t next = NIL; /* Towards the least recently used entry */
+        bool occupied = false;
+        bool referenced = false; /* Read since last moved to the front */
+    };
+
+    unsigned _capacity;
+    unsigned _size = 0;
+    uint32_t _mask;
+    uint32_t _head = NIL; /* Most recently used entry */
+    uint32_t _tail = NIL; /* Least recently used entry */
+    std::vector<Slot> _slots;
+    Hash _hash;
+
+    /**
+     * @brief homeSlot
+     *
+     * The table size is a power of two, so the hash has to mix all key bits
+     * into the low bits, otherwise the keys cluster. std::hash<XYZTileKey>
+     * already does that.
+     *
+     * @param key
+     * @return
+     */
+    uint32_t homeSlot(const K& key) const
+    {
+        return (uint32_t)_hash(key) & _mask;
+    }
+
+    /**
+     * @brief find
+     * @param key
+     * @return Slot index of the key or NIL
+     */
+    uint32_t find(const K& key) const
+    {
+        uint32_t index = homeSlot(key);
+        while (_slots[index].occupied) {
+            if (_slots[index].key == key)
+                return index;
+            index = (index + 1) & _mask;
+        }
+        return NIL;
+    }
+
+    void unlink(uint32_t index)
+    {
+        Slot& slot = _slots[index];
+
+        if (slot.prev != NIL)
+            _slots[slot.prev].next = slot.next;
+        else
+            _head = slot.next;
+
+        if (slot.next != NIL)
+            _slots[slot.next].prev = slot.prev;
+        else
+            _tail = slot.prev;
+    }
+
+    void linkFront(uint32_t index)
+    {
+        Slot& slot = _slots[index];
+        slot.prev = NIL;
+        slot.next = _head;
+
+        if (_head != NIL)
+            _slots[_head].prev = index;
+        else
+            _tail = index;
+
+        _head = index;
+    }
+
+    void moveToFront(uint32_t index)
+    {
+        if (index == _head)
+            return;
+
+        unlink(index);
+        linkFront(index);
+    }
+
+    /**
+     * @brief moveSlot
+     *
+     * Moves an entry to another (empty) slot and repairs the recency list
+     * around it.
+     *
+     * @param from
+     * @param to
+     */
+    void moveSlot(uint32_t from, uint32_t to)
+    {
+        _slots[to] = _slots[from];
+        _slots[from].occupied = false;
+
+        Slot& slot = _slots[to];
+
+        if (slot.prev != NIL)
+            _slots[slot.prev].next = to;
+        else
+            _head = to;
+
+        if (slot.next != NIL)
+            _slots[slot.next].prev = to;
+        else
+            _tail = to;
+    }
+
+    /**
+     * @brief eraseSlot
+     *
+     * Backward-shift deletion: entries following the hole in the same probe
+     * sequence are moved back, so that lookups never stop early.
+     *
+     * @param index
+     */
+    void eraseSlot(uint32_t index)
+    {
+        unlink(index);
+        _slots[index].occupied = false;
+        _size--;
+
+        uint32_t hole = index;
+        uint32_t current = (index + 1) & _mask;
+
+        while (_slots[current].occupied) {
+            uint32_t home = homeSlot(_slots[current].key);
+
+            /* The entry may only be moved if the hole lies on its probe
+             * sequence, i.e. between its home slot and its current slot */
+            if (((current - home) & _mask) >= ((current - hole) & _mask)) {
+                moveSlot(current, hole);
+                hole = current;
+            }
+            current = (current + 1) & _mask;
+        }
+    }
+
+public:
+    /**
+     * @brief FlatLRUCache
+     *
+     * Eviction in put() needs at least one entry, so the capacity must be
+     * positive.
+     *
+     * @param capacity
+     */
+    FlatLRUCache(int capacity)
+        : _capacity(capacity)
+    {
+        if (capacity < 1) {
+            std::cerr << "Error: LRU cache capacity must be positive" << std::endl;
+            std::exit(1);
+        }
+
+        uint32_t numSlots = 2;
+        while (numSlots < 2 * _capacity)
+            numSlots *= 2;
+
+        _mask = numSlots - 1;
+        _slots.resize(numSlots);
+    }
+
+    /**
+     * @brief get
+     *
+     * Returns the value and sets the reference bit of the entry, without
+     * moving it in the recency list.
+     *
+     * @param key
+     * @return
+     */
+    std::optional<V> get(const K& key)
+    {
+        uint32_t index = find(key);
+
+        /* Item not found */
+        if (index == NIL) {
+            return std::nullopt;
+        }
+
+        _slots[index].referenced = true;
+        return _slots[index].value;
+    }
+
+    /**
+     * @brief peek
+     *
+     * Returns the value without changing the recency order.
+     *
+     * @param key
+     * @return
+     */
+    std::optional<V> peek(const K& key) const
+    {
+        uint32_t index = find(key);
+
+        if (index == NIL) {
+            return std::nullopt;
+        }
+
+        return _slots[index].value;
+    }
+
+    /**
+     * @brief touch
+     *
+     * Sets the reference bit of the entry without returning it.
+     *
+     * @param key
+     * @return Whether the key was found
+     */
+    bool touch(const K& key)
+    {
+        uint32_t index = find(key);
+
+        if (index == NIL) {
+            return false;
+        }
+
+        _slots[index].referenced = true;
+        return true;
+    }
+
+    /**
+     * @brief size
+     * @return
+     */
+    unsigned size() const
+    {
+        return _size;
+    }
+
+    /**
+     * @brief capacity
+     * @return
+     */
+    unsigned capacity() const
+    {
+        return _capacity;
+    }
+
+    /**
+     * @brief contains
+     * @param key
+     * @return
+     */
+    bool contains(const K& key) const
+    {
+        return find(key) != NIL;
+    }
+
+    /**
+     * @brief evict
+     *
+     * Evicts the least recently used entry the predicate accepts. Rejected
+     * entries are moved to the front, like referenced ones. Every entry is
+     * checked at most once after its reference bit is cleared, so this
+     * terminates even if no entry is accepted.
+     *
+     * @param canEvict Called with the key and the value of an entry
+     * @return The evicted entry, if any
+     */
+    template <typename Predicate>
+    std::optional<std::pair<K, V>> evict(Predicate canEvict)
+    {
+        for (unsigned steps = 0; steps < 2 * _size; steps++) {
+            Slot& last = _slots[_tail];
+
+            if (!last.referenced && canEvict(last.key, last.value)) {
+                std::pair<K, V> evicted = std::make_pair(last.key, last.value);
+                eraseSlot(_tail);
+                return evicted;
+            }
+
+            last.referenced = false;
+            moveToFront(_tail);
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief put
+     *
+     * Without evictIfFull, the cache grows beyond its capacity instead of
+     * evicting, until evict() brings it back. The table has room for twice
+     * the capacity, only beyond that an entry is evicted regardless.
+     *
+     * @param key
+     * @param value
+     * @param evictIfFull
+     * @return
+     */
+    PutResult<K, V> put(const K& key, const V& value, bool evictIfFull = true)
+    {
+        PutResult<K, V> result { false, std::nullopt };
+
+        /* Update existing item */
+        uint32_t index = find(key);
+        if (index != NIL) {
+            _slots[index].value = value;
+            _slots[index].referenced = false;
+            moveToFront(index);
+            return result;
+        }
+
+        /* Evict LRU item, referenced items are moved to the front instead.
+         * This terminates since their reference bits are cleared. */
+        if (_size >= _capacity && (evictIfFull || _size >= _mask)) {
+            while (_slots[_tail].referenced) {
+                _slots[_tail].referenced = false;
+                moveToFront(_tail);
+            }
+
+            Slot& last = _slots[_tail];
+            result.evicted = true;
+            result.evictedItem = std::make_pair(last.key, last.value);
+            eraseSlot(_tail);
+        }
+
+        /* Insert new item */
+        index = homeSlot(key);
+        while (_slots[index].occupied)
+            index = (index + 1) & _mask;
+
+        Slot& slot = _slots[index];
+        slot.key = key;
+        slot.value = value;
+        slot.occupied = true;
+        slot.referenced = false;
+        linkFront(index);
+        _size++;
+
+        return result;
+    }
+};
+
+#endif // FLATLRUCACHE_H
@@ -0,0 +1,161 @@
+#include "frustumculling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUMCULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+/**
+ * @brief AABBBatch::set
+ * @param index
+ * @param p1 Minimum corner
+ * @param p2 Maximum corner
+ */
+void AABBBatch::set(unsigned index, const glm::vec3& p1, const glm::vec3& p2)
+{
+    centerX[index] = (p1.x + p2.x) * 0.5f;
+    centerY[index] = (p1.y + p2.y) * 0.5f;
+    centerZ[index] = (p1.z + p2.z) * 0.5f;
+    extentX[index] = (p2.x - p1.x) * 0.5f;
+    extentY[index] = (p2.y - p1.y) * 0.5f;
+    extentZ[index] = (p2.z - p1.z) * 0.5f;
+}
+
+namespace FrustumCulling {
+
+/* Side planes first, since they reject the most boxes */
+static const Plane Frustum::*const PLANES[6] = {
+    &Frustum::leftFace,
+    &Frustum::rightFace,
+    &Frustum::bottomFace,
+    &Frustum::topFace,
+    &Frustum::nearFace,
+    &Frustum::farFace
+};
+
+bool insideFrustum(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent)
+{
+    for (auto plane : PLANES) {
+        const Plane& p = frustum.*plane;
+        float r = extent.x * std::abs(p.normal.x)
+            + extent.y * std::abs(p.normal.y)
+            + extent.z * std::abs(p.normal.z);
+
+        if (p.getSignedDistanceToPlane(center) < -r)
+            return false;
+    }
+    return true;
+}
+
+unsigned cullBatch(const Frustum& frustum, const AABBBatch& batch)
+{
+    unsigned childPlaneMasks[4];
+    unsigned char lastRejectingPlane = 0;
+    unsigned planeTests = 0;
+    float slack;
+
+    return cullBatch(frustum, batch, ALL_PLANES, childPlaneMasks, lastRejectingPlane, planeTests, slack);
+}
+
+unsigned cullBatch(const Frustum& frustum, const AABBBatch& batch, unsigned planeMask,
+    unsigned childPlaneMasks[4], unsigned char& lastRejectingPlane, unsigned& planeTests, float& slack)
+{
+    unsigned visible = 0xF;
+    slack = std::numeric_limits<float>::max();
+
+    for (unsigned i = 0; i < 4; i++)
+        childPlaneMasks[i] = planeMask;
+
+#ifdef FRUSTUMCULLING_SSE
+    __m128 cx = _mm_load_ps(batch.centerX);
+    __m128 cy = _mm_load_ps(batch.centerY);
+    __m128 cz = _mm_load_ps(batch.centerZ);
+    __m128 ex = _mm_load_ps(batch.extentX);
+    __m128 ey = _mm_load_ps(batch.extentY);
+    __m128 ez = _mm_load_ps(batch.extentZ);
+    __m128 zero = _mm_setzero_ps();
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 minSlack = _mm_set1_ps(std::numeric_limits<float>::max());
+#endif
+
+    unsigned firstPlane = lastRejectingPlane;
+
+    for (unsigned j = 0; j < NUM_PLANES; j++) {
+        unsigned k = firstPlane + j;
+        if (k >= NUM_PLANES)
+            k -= NUM_PLANES;
+
+        if (!(planeMask & (1u << k)))
+            continue;
+
+        const Plane& p = frustum.*PLANES[k];
+        unsigned notOutside, inside;
+
+#ifdef FRUSTUMCULLING_SSE
+        /* Signed distance of the centers and the projected radii */
+        __m128 distance = _mm_sub_ps(
+            _mm_add_ps(_mm_add_ps(
+                           _mm_mul_ps(cx, _mm_set1_ps(p.normal.x)),
+                           _mm_mul_ps(cy, _mm_set1_ps(p.normal.y))),
+                _mm_mul_ps(cz, _mm_set1_ps(p.normal.z))),
+            _mm_set1_ps(p.distance));
+
+        __m128 radius = _mm_add_ps(_mm_add_ps(
+                                       _mm_mul_ps(ex, _mm_set1_ps(std::abs(p.normal.x))),
+                                       _mm_mul_ps(ey, _mm_set1_ps(std::abs(p.normal.y)))),
+            _mm_mul_ps(ez, _mm_set1_ps(std::abs(p.normal.z))));
+
+        __m128 outer = _mm_add_ps(distance, radius);
+        __m128 inner = _mm_sub_ps(distance, radius);
+
+        notOutside = (unsigned)_mm_movemask_ps(_mm_cmpge_ps(outer, zero));
+        inside = (unsigned)_mm_movemask_ps(_mm_cmpge_ps(inner, zero));
+
+        minSlack = _mm_min_ps(minSlack, _mm_min_ps(_mm_andnot_ps(signMask, outer), _mm_andnot_ps(signMask, inner)));
+#else
+        glm::vec3 absNormal(std::abs(p.normal.x), std::abs(p.normal.y), std::abs(p.normal.z));
+        notOutside = 0;
+        inside = 0;
+
+        for (unsigned i = 0; i < 4; i++) {
+            float distance = p.normal.x * batch.centerX[i] + p.normal.y * batch.centerY[i] + p.normal.z * batch.centerZ[i] - p.distance;
+            float radius = absNormal.x * batch.extentX[i] + absNormal.y * batch.extentY[i] + absNormal.z * batch.extentZ[i];
+
+            notOutside |= (distance + radius >= 0.0f) << i;
+            inside |= (distance - radius >= 0.0f) << i;
+
+            slack = std::min(slack, std::min(std::abs(distance + radius), std::abs(distance - radius)));
+        }
+#endif
+
+        planeTests += 4;
+
+        /* Remember the plane for the next frame if it rejected a box */
+        if ((visible & notOutside) != visible)
+            lastRejectingPlane = k;
+
+        visible &= notOutside;
+        if (visible == 0)
+            break;
+
+        if (inside) {
+            for (unsigned i = 0; i < 4; i++) {
+                if (inside & (1u << i))
+                    childPlaneMasks[i] &= ~(1u << k);
+            }
+        }
+    }
+
+#ifdef FRUSTUMCULLING_SSE
+    float lanes[4];
+    _mm_storeu_ps(lanes, minSlack);
+    slack = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+#endif
+
+    return visible;
+}
+}
@@ -0,0 +1,80 @@
+#ifndef FRUSTUMCULLING_H
+#define FRUSTUMCULLING_H
+
+#include <glm/vec3.hpp>
+
+#include "camera.h"
+
+/**
+ * @brief The AABBBatch struct
+ *
+ * Bounding boxes of four nodes (usually the four children of a node) as
+ * structure of arrays, so that they can be culled at once with SIMD.
+ * Box i is stored at index i of each array.
+ */
+struct alignas(16) AABBBatch {
+    float centerX[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float centerY[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float centerZ[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float extentX[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float extentY[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float extentZ[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    void set(unsigned index, const glm::vec3& p1, const glm::vec3& p2);
+};
+
+/**
+ * Frustum culling of single bounding boxes and batches of four.
+ *
+ * Planes are referred to by index in the order left, right, bottom, top,
+ * near, far. A plane mask has bit i set if plane i still needs to be tested,
+ * boxes fully inside a plane do not need to test it for their contents.
+ */
+namespace FrustumCulling {
+
+const unsigned NUM_PLANES = 6;
+const unsigned ALL_PLANES = 0x3F;
+
+/**
+ * @brief insideFrustum
+ * @param frustum
+ * @param center
+ * @param extent Half size of the box
+ * @return Whether the box intersects or is inside the frustum
+ */
+bool insideFrustum(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent);
+
+/**
+ * @brief cullBatch
+ *
+ * Tests four boxes at once against all planes. Stops as soon as all four
+ * boxes are rejected.
+ *
+ * @param frustum
+ * @param batch
+ * @return Bit mask, bit i is set if box i is inside the frustum
+ */
+unsigned cullBatch(const Frustum& frustum, const AABBBatch& batch);
+
+/**
+ * @brief cullBatch
+ *
+ * Hierarchical variant: only the planes in planeMask are tested, starting
+ * with the plane which rejected a box the last time.
+ *
+ * @param frustum
+ * @param batch
+ * @param planeMask Planes the enclosing box is not fully inside of
+ * @param childPlaneMasks Output, plane masks to pass on to the four boxes
+ * @param lastRejectingPlane In- and output, plane tested first
+ * @param planeTests Incremented by the number of box-plane tests done
+ * @param slack Output, smallest distance of a tested box to flipping any of
+ *              the computed results, i.e. how far the planes may move
+ *              before the result can change
+ * @return Bit mask, bit i is set if box i is inside the frustum
+ */
+unsigned cullBatch(const Frustum& frustum, const AABBBatch& batch, unsigned planeMask,
+    unsigned childPlaneMasks[4], unsigned char& lastRejectingPlane, unsigned& planeTests, float& slack);
+}
+
+#endif // FRUSTUMCULLING_H
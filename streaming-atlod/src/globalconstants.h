@@ -10,6 +10,10 @@ const glm::vec3 GLOBE_RADII_SQUARED(100000.0f);
 const glm::vec3 GLOBE_RADII(glm::sqrt(GLOBE_RADII_SQUARED));
 const float HEIGHT_SCALE = GLOBE_RADII.x / 6378137.0f;
 
+/* Deepest zoom levels rendered with the low and medium resolution meshes */
+const unsigned LOW_RES_MESH_MAX_ZOOM = 9;
+const unsigned MEDIUM_RES_MESH_MAX_ZOOM = 11;
+
 const float CAMERA_NEAR = 0.01f;
 const float CAMERA_FAR = 1300.0f;
 
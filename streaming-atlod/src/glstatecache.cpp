@@ -0,0 +1,139 @@
+#include "glstatecache.h"
+
+GlStateCache* GlStateCache::_cache = nullptr;
+
+GlStateCache::GlStateCache() { }
+
+/**
+ * @brief GlStateCache::getInstance
+ * @return
+ */
+GlStateCache* GlStateCache::getInstance()
+{
+    if (!_cache) {
+        _cache = new GlStateCache();
+    }
+    return _cache;
+}
+
+/**
+ * @brief GlStateCache::invalidate Forgets the tracked state, so that the next
+ *        call of each setter reaches OpenGL.
+ */
+void GlStateCache::invalidate()
+{
+    _known = 0;
+}
+
+/**
+ * @brief GlStateCache::known Marks the state as known from now on
+ * @param bit
+ * @return Whether the state was known before
+ */
+bool GlStateCache::known(StateBit bit)
+{
+    bool wasKnown = _known & bit;
+    _known |= bit;
+    return wasKnown;
+}
+
+/**
+ * @brief GlStateCache::useProgram
+ * @param program
+ */
+void GlStateCache::useProgram(unsigned program)
+{
+    if (known(PROGRAM) && _program == program) {
+        _filteredCalls++;
+        return;
+    }
+
+    glUseProgram(program);
+    _program = program;
+}
+
+/**
+ * @brief GlStateCache::bindVertexArray
+ * @param vao
+ */
+void GlStateCache::bindVertexArray(unsigned vao)
+{
+    if (known(VERTEX_ARRAY) && _vao == vao) {
+        _filteredCalls++;
+        return;
+    }
+
+    glBindVertexArray(vao);
+    _vao = vao;
+}
+
+/**
+ * @brief GlStateCache::setPrimitiveRestart
+ * @param enabled
+ * @param restartIndex Only set if enabled
+ */
+void GlStateCache::setPrimitiveRestart(bool enabled, GLuint restartIndex)
+{
+    if (known(PRIMITIVE_RESTART) && _primitiveRestart == enabled && (!enabled || _restartIndex == restartIndex)) {
+        _filteredCalls++;
+        return;
+    }
+
+    if (enabled) {
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restartIndex);
+    } else {
+        glDisable(GL_PRIMITIVE_RESTART);
+    }
+
+    _primitiveRestart = enabled;
+    _restartIndex = restartIndex;
+}
+
+/**
+ * @brief GlStateCache::setPolygonMode Sets the mode for both front and back
+ *        faces.
+ * @param mode
+ */
+void GlStateCache::setPolygonMode(GLenum mode)
+{
+    if (known(POLYGON_MODE) && _polygonMode == mode) {
+        _filteredCalls++;
+        return;
+    }
+
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    _polygonMode = mode;
+}
+
+/**
+ * @brief GlStateCache::setCullFace
+ * @param face
+ */
+void GlStateCache::setCullFace(GLenum face)
+{
+    if (known(CULL_FACE) && _cullFace == face) {
+        _filteredCalls++;
+        return;
+    }
+
+    glCullFace(face);
+    _cullFace = face;
+}
+
+/**
+ * @brief GlStateCache::filteredCalls
+ * @return Number of redundant calls filtered since the last reset
+ */
+unsigned GlStateCache::filteredCalls() const
+{
+    return _filteredCalls;
+}
+
+/**
+ * @brief GlStateCache::resetFilteredCalls
+ */
+void GlStateCache::resetFilteredCalls()
+{
+    _filteredCalls = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+/**
+ * @brief Tracks the GL state touched by the terrain renderer and filters
+ *        calls which would not change it.
+ *
+ * The cache only knows about changes made through it. Code that changes the
+ * state directly (for e.g. ImGui) has to be followed by invalidate().
+ *
+ * ATTENTION: Like all GL calls, this class must only be used on the render
+ *            thread.
+ */
+class GlStateCache {
+public:
+    static GlStateCache* getInstance();
+
+    void invalidate();
+
+    void useProgram(unsigned program);
+    void bindVertexArray(unsigned vao);
+    void setPrimitiveRestart(bool enabled, GLuint restartIndex);
+    void setPolygonMode(GLenum mode);
+    void setCullFace(GLenum face);
+
+    unsigned filteredCalls() const;
+    void resetFilteredCalls();
+
+protected:
+    GlStateCache();
+
+    static GlStateCache* _cache;
+
+    enum StateBit {
+        PROGRAM = 1 << 0,
+        VERTEX_ARRAY = 1 << 1,
+        PRIMITIVE_RESTART = 1 << 2,
+        POLYGON_MODE = 1 << 3,
+        CULL_FACE = 1 << 4
+    };
+
+    bool known(StateBit bit);
+
+    /* Zero is a valid value for all of these, so which of them are known is
+     * tracked separately */
+    unsigned _known = 0;
+    unsigned _program;
+    unsigned _vao;
+    bool _primitiveRestart;
+    GLuint _restartIndex;
+    GLenum _polygonMode;
+    GLenum _cullFace;
+
+    unsigned _filteredCalls = 0;
+};
+
+#endif // GLSTATECACHE_H
@@ -1,7 +1,10 @@
 #include "gridmesh.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
+#include "glstatecache.h"
 #include "util.h"
 
 /**
@@ -27,31 +30,64 @@ void GridMesh::load()
  */
 void GridMesh::render()
 {
-    glEnable(GL_PRIMITIVE_RESTART);
-    glPrimitiveRestartIndex(RESTART_INDEX);
-    glBindVertexArray(_vao);
-    glDrawElements(GL_TRIANGLE_STRIP, _indices.size() * sizeof(unsigned int), GL_UNSIGNED_INT, (void*)0);
-    Util::checkGlError("Error: Gridmesh rendering error");
-    glDisable(GL_PRIMITIVE_RESTART);
+    GlStateCache::getInstance()->bindVertexArray(_vao);
+    glDrawElements(GL_TRIANGLES, _indices.size(), _indexType, (void*)0);
+}
+
+/**
+ * @brief GridMesh::triangleCount
+ * @return
+ */
+unsigned GridMesh::triangleCount() const
+{
+    return _indices.size() / 3;
+}
+
+/**
+ * @brief GridMesh::indexType
+ * @return GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+ */
+GLenum GridMesh::indexType() const
+{
+    return _indexType;
+}
+
+/**
+ * @brief GridMesh::vertexPosition Position of a grid vertex around the center
+ *        of the tile
+ * @param index Column or row
+ * @return
+ */
+float GridMesh::vertexPosition(unsigned index) const
+{
+    return (-(float)_sideLength / 2.0f + (float)_sideLength * index / (float)_sideLength) + 0.5f;
 }
 
 /**
  * @brief GridMesh::loadVertices
+ *
+ * The grid vertices are followed by the skirt vertices, which duplicate the
+ * border of the grid and are lowered in the vertex shader. The skirt ring
+ * starts at the top left corner and goes around clockwise.
  */
 void GridMesh::loadVertices()
 {
     /* Create VAO and VBO and load vertices */
-    for (int i = 0; i < _sideLength; i++) {
-        for (int j = 0; j < _sideLength; j++) {
-            /* Load vertices around center point */
-            float x = (-(float)_sideLength / 2.0f + (float)_sideLength * j / (float)_sideLength) + 0.5f;
-            float z = (-(float)_sideLength / 2.0f + (float)_sideLength * i / (float)_sideLength) + 0.5f;
-
-            _vertices.push_back(x); /* Position x */
-            _vertices.push_back(z); /* Position z */
+    for (unsigned i = 0; i < _sideLength; i++) {
+        for (unsigned j = 0; j < _sideLength; j++) {
+            _vertices.push_back(vertexPosition(j)); /* Position x */
+            _vertices.push_back(vertexPosition(i)); /* Position z */
+            _vertices.push_back(0); /* Skirt vertex false */
         }
     }
 
+    for (unsigned index : borderIndices(_sideLength)) {
+        unsigned i = index / _sideLength, j = index % _sideLength;
+        _vertices.push_back(vertexPosition(j)); /* Position x */
+        _vertices.push_back(vertexPosition(i)); /* Position z */
+        _vertices.push_back(1); /* Skirt vertex true */
+    }
+
     glGenVertexArrays(1, &_vao);
     glBindVertexArray(_vao);
 
@@ -63,29 +99,107 @@ void GridMesh::loadVertices()
 
     Util::checkGlError("GRIDMESH VBO LOAD FAILED");
 
-    /* Position attribute */
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    /* Position and skirt flag attribute */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
     Util::checkGlError("GRIDMESH VAO LOAD FAILED");
 }
 
 /**
- * @brief GridMesh::loadIndices
+ * @brief GridMesh::borderIndices
+ * @param sideLength
+ * @return Indices of the grid vertices on the border, clockwise from the top
+ *         left corner
  */
-void GridMesh::loadIndices()
+std::vector<unsigned> GridMesh::borderIndices(unsigned sideLength)
 {
-    for (unsigned int i = 0; i < _sideLength - 1; i++) {
-        for (unsigned int j = 0; j < _sideLength; j++) {
-            _indices.push_back(j + _sideLength * i);
-            _indices.push_back(j + _sideLength * (i + 1));
+    std::vector<unsigned> border;
+    unsigned last = sideLength - 1;
+
+    for (unsigned j = 0; j < sideLength; j++)
+        border.push_back(j);
+    for (unsigned i = 1; i < last; i++)
+        border.push_back(last + sideLength * i);
+    for (unsigned j = sideLength; j > 0; j--)
+        border.push_back(j - 1 + sideLength * last);
+    for (unsigned i = last - 1; i >= 1; i--)
+        border.push_back(sideLength * i);
+
+    return border;
+}
+
+/**
+ * @brief GridMesh::generateIndices
+ *
+ * The grid quads are emitted in stripes of stripeWidth columns, row by row
+ * within a stripe, followed by the skirt quads around the tile. Each quad
+ * between a top and a bottom row is split into (top j, bottom j, top j+1)
+ * and (top j+1, bottom j, bottom j+1), which is the winding the strips had.
+ *
+ * @param sideLength
+ * @param stripeWidth
+ * @return
+ */
+std::vector<unsigned> GridMesh::generateIndices(unsigned sideLength, unsigned stripeWidth)
+{
+    std::vector<unsigned> indices;
+    unsigned quads = sideLength - 1;
+    indices.reserve((quads * quads + 4 * quads) * 6);
+
+    auto addQuad = [&indices](unsigned top0, unsigned bottom0, unsigned top1, unsigned bottom1) {
+        indices.push_back(top0);
+        indices.push_back(bottom0);
+        indices.push_back(top1);
+        indices.push_back(top1);
+        indices.push_back(bottom0);
+        indices.push_back(bottom1);
+    };
+
+    for (unsigned stripe = 0; stripe < quads; stripe += stripeWidth) {
+        unsigned stripeEnd = std::min(stripe + stripeWidth, quads);
+
+        for (unsigned i = 0; i < quads; i++) {
+            for (unsigned j = stripe; j < stripeEnd; j++) {
+                addQuad(j + sideLength * i, j + sideLength * (i + 1),
+                    j + 1 + sideLength * i, j + 1 + sideLength * (i + 1));
+            }
         }
-        _indices.push_back(RESTART_INDEX);
     }
 
+    /* The skirt vertices follow the grid vertices in border order */
+    std::vector<unsigned> border = borderIndices(sideLength);
+    unsigned firstSkirtVertex = sideLength * sideLength;
+
+    for (unsigned k = 0; k < border.size(); k++) {
+        unsigned next = (k + 1) % border.size();
+        addQuad(firstSkirtVertex + k, border[k], firstSkirtVertex + next, border[next]);
+    }
+
+    return indices;
+}
+
+/**
+ * @brief GridMesh::loadIndices
+ */
+void GridMesh::loadIndices()
+{
+    _indices = generateIndices(_sideLength);
+
     glGenBuffers(1, &_ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(unsigned), &_indices[0], GL_STATIC_DRAW);
+
+    /* Halve the index buffer if all vertices are addressable with 16 bit */
+    if (_vertices.size() / 3 <= std::numeric_limits<std::uint16_t>::max() + 1) {
+        std::vector<std::uint16_t> shortIndices(_indices.begin(), _indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(std::uint16_t), &shortIndices[0], GL_STATIC_DRAW);
+        _indexType = GL_UNSIGNED_SHORT;
+    } else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(unsigned), &_indices[0], GL_STATIC_DRAW);
+        _indexType = GL_UNSIGNED_INT;
+    }
+
+    Util::checkGlError("GRIDMESH EBO LOAD FAILED");
 }
 
 /**
@@ -4,29 +4,48 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
-#include <limits>
+#include <cstdint>
 #include <vector>
 
 #include "util.h"
 
+/**
+ * @brief Tile mesh of a resolution, the grid and the skirt around it, which
+ *        hides the cracks between neighbouring tiles. Each vertex is the
+ *        position and a flag marking skirt vertices.
+ *
+ * The mesh is an indexed triangle list. The grid is walked in vertical
+ * stripes, row by row within a stripe, so that the vertices shared with the
+ * previous row are still in the post-transform cache. The indices are 16 bit
+ * if the vertex count allows it.
+ */
 class GridMesh
 {
 public:
-    static constexpr GLuint RESTART_INDEX = std::numeric_limits<GLuint>::max();
+    /* Quads per stripe, the two rows of a stripe fit a 16 entry FIFO cache */
+    static constexpr unsigned STRIPE_WIDTH = 7;
 
     GridMesh(unsigned sideLength);
     void load();
     void render();
     void unload();
 
+    unsigned triangleCount() const;
+    GLenum indexType() const;
+
+    static std::vector<unsigned> generateIndices(unsigned sideLength, unsigned stripeWidth = STRIPE_WIDTH);
+    static std::vector<unsigned> borderIndices(unsigned sideLength);
+
     // private:
     unsigned _sideLength;
     std::vector<unsigned> _indices;
     std::vector<float> _vertices;
     unsigned _vao, _vbo, _ebo;
+    GLenum _indexType;
 
     void loadVertices();
     void loadIndices();
+    float vertexPosition(unsigned index) const;
 };
 
 #endif // GRIDMESH_H
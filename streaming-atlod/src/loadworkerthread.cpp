@@ -11,6 +11,7 @@
 #include "globalconstants.h"
 #include "mapprojections.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <iostream>
 #include <webp/decode.h>
@@ -53,13 +54,21 @@ void LoadWorkerThread::processAllRequests()
 {
     auto requests = _requestQueue->popAll();
 
+    /* Load the most important tiles of the batch first */
+    std::stable_sort(requests.begin(), requests.end(), [](const LoadRequest& a, const LoadRequest& b) {
+        return a.priority < b.priority;
+    });
+
     bool returnNetworkErrors = false;
 
     for (auto request : requests) {
         if (request.type == LOAD_STOP_THREAD) {
             _stopThread = true;
+            continue;
         }
-        LoadResponse response = { LOAD_OK, request.tileKey, nullptr, nullptr, nullptr, 0, 0, 0, 0, 0, LOAD_ORIGIN_DISK_CACHE };
+        LoadResponseLayer layer = request.type == LOAD_REQUEST_OVERLAY ? LOAD_LAYER_OVERLAY : LOAD_LAYER_HEIGHT;
+        LoadResponse response = { LOAD_OK, request.tileKey, nullptr, nullptr, nullptr, 0, 0, 0, 0, 0, LOAD_ORIGIN_DISK_CACHE, layer };
+        response.priority = request.priority;
 
         /* If at any point we got a network error in the current queue processing,
          * do not bother with the rest of the requests, simply return error
@@ -70,12 +79,24 @@ void LoadWorkerThread::processAllRequests()
             continue;
         }
 
-        fetchHeightmap(request, response);
+        /* Prewarm requests only fill the disk cache, there is no need to
+         * decode anything or to create a node */
+        if (request.type == LOAD_REQUEST_PREWARM) {
+            prewarmDiskCache(request, response);
 
-        if (response.type != LOAD_OK) {
+            /* Unexpected status codes only concern this tile */
+            if (response.type == LOAD_ERROR && response.httpStatusCode == 0) {
+                returnNetworkErrors = true;
+            }
+
+            _doneQueue->push(response);
+            continue;
+        }
+
+        /* Overlay of a node which already has its heights */
+        if (request.type == LOAD_REQUEST_OVERLAY) {
+            fetchOverlay(request, response);
 
-            /* Found a network error, we now skip all items in the queue
-             * in the next iterations */
             if (response.type == LOAD_ERROR) {
                 returnNetworkErrors = true;
             }
@@ -84,7 +105,7 @@ void LoadWorkerThread::processAllRequests()
             continue;
         }
 
-        fetchOverlay(request, response);
+        fetchHeightmap(request, response);
 
         if (response.type != LOAD_OK) {
 
@@ -98,19 +119,33 @@ void LoadWorkerThread::processAllRequests()
             continue;
         }
 
-        if (response.type == LOAD_OK) {
-            TerrainNode* newTile = new TerrainNode(request.tileKey);
-            newTile->_heightData = response.heightData;
+        TerrainNode* newTile = new TerrainNode(request.tileKey);
+        newTile->_heightData = response.heightData;
 
-            newTile->generateMinMaxHeight();
-            newTile->generateAabb();
-            newTile->generateProjectedGridPoints();
-            newTile->generateHorizonPoints();
+        newTile->generateMinMaxHeight();
+        newTile->generateAabb();
+        newTile->generateGeometricError(meshResolution(request.tileKey.z()));
+        newTile->generateHorizonOcclusionPoint();
 
-            response.node = newTile;
-        }
+        if (request.tileKey.z() > 0)
+            newTile->generateChildPredictions();
 
+        newTile->_overlayState = request.type == LOAD_REQUEST_DISK_CACHE ? TerrainNode::LOADING_FROM_DISK : TerrainNode::DOWNLOADING_FROM_API;
+        response.node = newTile;
+
+        /* Hand out the heights right away, the overlay is the larger
+         * download */
         _doneQueue->push(response);
+
+        LoadResponse overlayResponse = { LOAD_OK, request.tileKey, nullptr, nullptr, nullptr, 0, 0, 0, 0, 0, LOAD_ORIGIN_DISK_CACHE, LOAD_LAYER_OVERLAY };
+        overlayResponse.priority = request.priority;
+        fetchOverlay(request, overlayResponse);
+
+        if (overlayResponse.type == LOAD_ERROR) {
+            returnNetworkErrors = true;
+        }
+
+        _doneQueue->push(overlayResponse);
     }
 
     if (_stopThread) {
@@ -143,7 +178,11 @@ void LoadWorkerThread::fetchHeightmap(LoadRequest& request, LoadResponse& respon
  */
 void LoadWorkerThread::fetchOverlay(LoadRequest& request, LoadResponse& response)
 {
-    if (request.type == LOAD_REQUEST_DISK_CACHE) {
+    /* Overlays requested on their own might have been persisted already */
+    bool onDisk = request.type == LOAD_REQUEST_DISK_CACHE
+        || (request.type == LOAD_REQUEST_OVERLAY && std::filesystem::exists(overlayFilePath(request.tileKey)));
+
+    if (onDisk) {
         loadOverlayFromDisk(request, response);
         response.origin = LOAD_ORIGIN_DISK_CACHE;
     } else if (!request.offlineMode) {
@@ -152,6 +191,57 @@ void LoadWorkerThread::fetchOverlay(LoadRequest& request, LoadResponse& response
     } else { /* Offline mode, we cannot request new tiles */
         response.type = LOAD_UNLOADABLE;
     }
+
+    /* The texture pool cannot generate the mipmaps of a single layer */
+    if (response.type == LOAD_OK && response.overlayNrChannels == 3)
+        response.overlayMipmaps = generateMipmaps(response.overlayData, response.overlayWidth, response.overlayHeight);
+}
+
+/**
+ * @brief LoadWorkerThread::generateMipmaps
+ *
+ * Generates the mip levels of an RGB image with a box filter, each level
+ * from the previous one.
+ *
+ * @param data
+ * @param width
+ * @param height
+ * @return The levels below the base level packed after each other, down to
+ *         1x1. Must be deallocated with delete[].
+ */
+unsigned char* LoadWorkerThread::generateMipmaps(const unsigned char* data, int width, int height)
+{
+    if (width != height || width < 2 || (width & (width - 1)) != 0)
+        return nullptr;
+
+    std::size_t totalSize = 0;
+    for (int size = width / 2; size >= 1; size /= 2)
+        totalSize += (std::size_t)size * size * 3;
+
+    unsigned char* mipmaps = new unsigned char[totalSize];
+    const unsigned char* source = data;
+    unsigned char* target = mipmaps;
+
+    for (int size = width / 2; size >= 1; size /= 2) {
+        int sourceSize = size * 2;
+
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                const unsigned char* topLeft = source + ((2 * y) * sourceSize + 2 * x) * 3;
+                const unsigned char* bottomLeft = topLeft + sourceSize * 3;
+
+                for (int c = 0; c < 3; c++) {
+                    unsigned sum = topLeft[c] + topLeft[c + 3] + bottomLeft[c] + bottomLeft[c + 3];
+                    target[(y * size + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+
+        source = target;
+        target += size * size * 3;
+    }
+
+    return mipmaps;
 }
 
 /**
@@ -162,7 +252,7 @@ void LoadWorkerThread::fetchOverlay(LoadRequest& request, LoadResponse& response
 void LoadWorkerThread::loadHeightmapFromDisk(LoadRequest& request, LoadResponse& response)
 {
     XYZTileKey tileKey = request.tileKey;
-    std::string fileName = ConfigManager::getInstance()->diskCachePath() + GlobalConstants::HEIGHTDATA_DIR_NAME + std::to_string(tileKey.x()) + "_" + std::to_string(tileKey.y()) + "_" + std::to_string(tileKey.z()) + ".webp";
+    std::string fileName = heightmapFilePath(tileKey);
 
     std::ifstream file(fileName, std::ios::binary);
     if (!file) {
@@ -217,7 +307,7 @@ void LoadWorkerThread::loadOverlayFromDisk(LoadRequest& request, LoadResponse& r
 {
     XYZTileKey tileKey = request.tileKey;
     int width, height, nrChannels;
-    std::string fileName = ConfigManager::getInstance()->diskCachePath() + GlobalConstants::OVERLAY_DIR_NAME + std::to_string(tileKey.x()) + "_" + std::to_string(tileKey.y()) + "_" + std::to_string(tileKey.z()) + ".jpg";
+    std::string fileName = overlayFilePath(tileKey);
     unsigned char* data = stbi_load(fileName.c_str(), &width, &height, &nrChannels, 0);
 
     if (data) {
@@ -248,155 +338,173 @@ size_t writeData(void* ptr, size_t size, size_t nmemb, std::string* data)
 }
 
 /**
- * @brief LoadWorkerThread::loadHeightmapFromApi
- * @param request
- * @param response
+ * @brief LoadWorkerThread::downloadFromApi
+ *
+ * Performs a blocking GET request on the given URL. The HTTP status code is
+ * written to httpStatusCode, unknown status codes are reported as LOAD_ERROR
+ * and left to the caller to handle.
+ *
+ * @param url
+ * @param responseData
+ * @param httpStatusCode
+ * @return
  */
-void LoadWorkerThread::loadHeightmapFromApi(LoadRequest& request, LoadResponse& response)
+LoadResponseType LoadWorkerThread::downloadFromApi(const std::string& url, std::string& responseData, long& httpStatusCode)
 {
+    if (!_curl) {
+        std::cerr << "Curl failed" << std::endl;
+        std::exit(1);
+    }
 
-    CURLcode res;
-    XYZTileKey tileKey = request.tileKey;
+    curl_easy_setopt(_curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, writeData);
+    curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &responseData);
+    curl_easy_setopt(_curl, CURLOPT_TIMEOUT, 5L);
 
-    std::string responseData;
-    std::string url = ConfigManager::getInstance()->heightDataServiceUrl()
-        + std::to_string(tileKey.z()) + "/"
-        + std::to_string(tileKey.x()) + "/"
-        + std::to_string(tileKey.y()) + ".webp?key=" + ConfigManager::getInstance()->heightDataServiceKey();
+    httpStatusCode = 0;
+    CURLcode retCode = curl_easy_perform(_curl);
 
-    if (_curl) {
-        curl_easy_setopt(_curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, writeData);
-        curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &responseData);
-        curl_easy_setopt(_curl, CURLOPT_TIMEOUT, 5L);
+    if (retCode == CURLE_OPERATION_TIMEDOUT) {
+        return LOAD_TIMEOUT;
+    }
 
-        int httpStatusCode = 0;
-        int retCode = curl_easy_perform(_curl);
+    if (retCode != CURLE_OK) { /* Network error */
+        return LOAD_ERROR;
+    }
 
-        if (retCode == CURLE_OPERATION_TIMEDOUT) {
-            std::cout << "Heightmap timeout" << std::endl;
-            response.type = LOAD_TIMEOUT;
-            return;
-        }
+    curl_easy_getinfo(_curl, CURLINFO_RESPONSE_CODE, &httpStatusCode);
 
-        curl_easy_getinfo(_curl, CURLINFO_RESPONSE_CODE, &httpStatusCode);
+    if (httpStatusCode == 204) { /* Empty tile */
+        return LOAD_UNLOADABLE;
+    } else if (httpStatusCode != 200) {
+        return LOAD_ERROR;
+    }
 
-        if (retCode != CURLE_OK) { /* Network error */
-            response.type = LOAD_ERROR;
-            return;
-        } else if (httpStatusCode == 204) { /* Empty tile */
-            response.type = LOAD_UNLOADABLE;
-            return;
-        } else if (httpStatusCode != 200) { /* Bad error, should never happen */
-            std::cerr << "Error: Status code " << httpStatusCode << " while loading heightmap " << tileKey.string() << std::endl;
-            std::exit(1);
-        } else {
-            int width, height;
-            if (WebPGetInfo((const uint8_t*)(responseData.data()), responseData.size(), &width, &height) != 1) {
-                std::cerr << "Error: Failed to get WebP image info" << std::endl;
-                response.type = LOAD_UNLOADABLE;
-                std::exit(1);
-                return;
-            }
+    return LOAD_OK;
+}
 
-            unsigned char* data = new unsigned char[width * height * 3];
+/**
+ * @brief LoadWorkerThread::persistToDiskCache
+ *
+ * The data is first written to a temporary file which is then renamed, so
+ * that an interrupted write never leaves a truncated tile behind in the
+ * disk cache.
+ *
+ * @param filePath
+ * @param data
+ * @return
+ */
+bool LoadWorkerThread::persistToDiskCache(const std::string& filePath, const std::string& data)
+{
+    std::string tempFilePath = filePath + ".part";
 
-            if (WebPDecodeRGBInto((const uint8_t*)(responseData.data()), responseData.size(),
-                    data, width * height * 3, width * 3)
-                == nullptr) {
-                std::cerr << "Error: Failed to decode WebP image" << std::endl;
-                delete[] data;
-                response.type = LOAD_UNLOADABLE;
-                std::exit(1);
-                return;
-            }
+    std::ofstream file(tempFilePath, std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
 
-            std::string filePath = ConfigManager::getInstance()->diskCachePath() + GlobalConstants::HEIGHTDATA_DIR_NAME
-                + std::to_string(tileKey.x()) + "_"
-                + std::to_string(tileKey.y()) + "_"
-                + std::to_string(tileKey.z()) + ".webp";
-
-            std::ofstream file(filePath, /*std::ios::out |*/ std::ios::binary);
-            if (file.is_open()) {
-                file.write(responseData.c_str(), responseData.size());
-                file.close();
-            } else {
-                std::cerr << "Failed to open file for writing. " << tileKey.string() << std::endl;
-                std::exit(1);
-            }
-            response.heightData = data;
-            response.heightWidth = width;
-            response.heightHeight = height;
-            response.type = LOAD_OK;
-        }
-    } else {
-        std::cerr << "Curl failed" << std::endl;
-        std::exit(1);
+    file.write(data.c_str(), data.size());
+    file.close();
+
+    std::error_code error;
+    if (!file) {
+        std::filesystem::remove(tempFilePath, error);
+        return false;
+    }
+
+    std::filesystem::rename(tempFilePath, filePath, error);
+    if (error) {
+        std::filesystem::remove(tempFilePath, error);
+        return false;
     }
+    return true;
 }
 
 /**
- * @brief LoadWorkerThread::loadOverlayFromApi
+ * @brief LoadWorkerThread::loadHeightmapFromApi
  * @param request
  * @param response
  */
-void LoadWorkerThread::loadOverlayFromApi(LoadRequest& request, LoadResponse& response)
+void LoadWorkerThread::loadHeightmapFromApi(LoadRequest& request, LoadResponse& response)
 {
     XYZTileKey tileKey = request.tileKey;
 
     std::string responseData;
-    std::string url = ConfigManager::getInstance()->overlayDataServiceUrl()
-        + std::to_string(tileKey.z()) + "/"
-        + std::to_string(tileKey.x()) + "/"
-        + std::to_string(tileKey.y()) + ".jpg?key=" + ConfigManager::getInstance()->overlayDataServiceKey();
+    long httpStatusCode;
+    response.type = downloadFromApi(heightmapUrl(tileKey), responseData, httpStatusCode);
 
-    if (!_curl) {
-        std::cerr << "Curl failed" << std::endl;
+    if (response.type == LOAD_TIMEOUT) {
+        std::cout << "Heightmap timeout" << std::endl;
+        return;
+    } else if (response.type == LOAD_ERROR && httpStatusCode != 0) { /* Bad error, should never happen */
+        std::cerr << "Error: Status code " << httpStatusCode << " while loading heightmap " << tileKey.string() << std::endl;
         std::exit(1);
+    } else if (response.type != LOAD_OK) {
+        return;
     }
 
-    curl_easy_setopt(_curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, writeData);
-    curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &responseData);
-    curl_easy_setopt(_curl, CURLOPT_TIMEOUT, 5L);
+    int width, height;
+    if (WebPGetInfo((const uint8_t*)(responseData.data()), responseData.size(), &width, &height) != 1) {
+        std::cerr << "Error: Failed to get WebP image info" << std::endl;
+        response.type = LOAD_UNLOADABLE;
+        std::exit(1);
+        return;
+    }
 
-    int httpStatusCode = 0;
-    int retCode = curl_easy_perform(_curl);
+    unsigned char* data = new unsigned char[width * height * 3];
 
-    if (retCode == CURLE_OPERATION_TIMEDOUT) {
-        std::cout << "Heightmap timeout" << std::endl;
-        response.type = LOAD_TIMEOUT;
+    if (WebPDecodeRGBInto((const uint8_t*)(responseData.data()), responseData.size(),
+            data, width * height * 3, width * 3)
+        == nullptr) {
+        std::cerr << "Error: Failed to decode WebP image" << std::endl;
+        delete[] data;
+        response.type = LOAD_UNLOADABLE;
+        std::exit(1);
         return;
     }
 
-    curl_easy_getinfo(_curl, CURLINFO_RESPONSE_CODE, &httpStatusCode);
+    if (!persistToDiskCache(heightmapFilePath(tileKey), responseData)) {
+        std::cerr << "Failed to open file for writing. " << tileKey.string() << std::endl;
+        std::exit(1);
+    }
+
+    response.heightData = data;
+    response.heightWidth = width;
+    response.heightHeight = height;
+    response.type = LOAD_OK;
+}
 
-    if (retCode != CURLE_OK) {
-        std::cerr << "Network error" << std::endl;
-        response.type = LOAD_ERROR;
+/**
+ * @brief LoadWorkerThread::loadOverlayFromApi
+ * @param request
+ * @param response
+ */
+void LoadWorkerThread::loadOverlayFromApi(LoadRequest& request, LoadResponse& response)
+{
+    XYZTileKey tileKey = request.tileKey;
+
+    std::string responseData;
+    long httpStatusCode;
+    response.type = downloadFromApi(overlayUrl(tileKey), responseData, httpStatusCode);
+
+    if (response.type == LOAD_TIMEOUT) {
+        std::cout << "Overlay timeout" << std::endl;
         return;
-    } else if (httpStatusCode == 204) {
+    } else if (response.type == LOAD_UNLOADABLE) {
         std::cerr << "Tile is empty" << std::endl;
-        response.type = LOAD_UNLOADABLE;
         return;
-    } else if (httpStatusCode != 200) {
-        std::cerr << "Status code " << httpStatusCode << " in loading overlay" << std::endl;
-        response.type = LOAD_ERROR;
+    } else if (response.type == LOAD_ERROR) {
+        if (httpStatusCode != 0)
+            std::cerr << "Status code " << httpStatusCode << " in loading overlay" << std::endl;
+        else
+            std::cerr << "Network error" << std::endl;
         return;
     }
 
     int width, height, nrChannels;
     unsigned char* data = stbi_load_from_memory((unsigned char*)responseData.c_str(), responseData.size(), &width, &height, &nrChannels, 0);
     if (data) {
-        std::string filePath = ConfigManager::getInstance()->diskCachePath() + GlobalConstants::OVERLAY_DIR_NAME
-            + std::to_string(tileKey.x()) + "_"
-            + std::to_string(tileKey.y()) + "_"
-            + std::to_string(tileKey.z()) + ".jpg";
-        std::ofstream file(filePath, std::ios::out | std::ios::binary);
-        if (file.is_open()) {
-            file.write(responseData.c_str(), responseData.size());
-            file.close();
-        } else {
+        if (!persistToDiskCache(overlayFilePath(tileKey), responseData)) {
             std::cerr << "Failed to open file for writing." << std::endl;
             std::exit(1);
         }
@@ -411,3 +519,110 @@ void LoadWorkerThread::loadOverlayFromApi(LoadRequest& request, LoadResponse& re
         std::exit(1);
     }
 }
+
+/**
+ * @brief LoadWorkerThread::prewarmDiskCache
+ *
+ * Downloads both layers of a tile and stores them in the disk cache without
+ * decoding them. Nothing is written unless both layers are available, since
+ * the disk cache only indexes tiles which have a heightmap and an overlay.
+ * The layer of the response tells which download failed, together with its
+ * status code.
+ *
+ * @param request
+ * @param response
+ */
+void LoadWorkerThread::prewarmDiskCache(LoadRequest& request, LoadResponse& response)
+{
+    XYZTileKey tileKey = request.tileKey;
+    response.origin = LOAD_ORIGIN_API;
+
+    std::string heightData, overlayData;
+
+    response.layer = LOAD_LAYER_HEIGHT;
+    response.type = downloadFromApi(heightmapUrl(tileKey), heightData, response.httpStatusCode);
+    if (response.type != LOAD_OK)
+        return;
+
+    response.layer = LOAD_LAYER_OVERLAY;
+    response.type = downloadFromApi(overlayUrl(tileKey), overlayData, response.httpStatusCode);
+    if (response.type != LOAD_OK)
+        return;
+
+    if (!persistToDiskCache(heightmapFilePath(tileKey), heightData)
+        || !persistToDiskCache(overlayFilePath(tileKey), overlayData)) {
+        std::cerr << "Failed to write tile " << tileKey.string() << " to the disk cache" << std::endl;
+        std::exit(1);
+    }
+}
+
+/**
+ * @brief LoadWorkerThread::meshResolution
+ * @param zoom
+ * @return Number of vertices per side of the mesh used for this zoom level
+ */
+unsigned LoadWorkerThread::meshResolution(unsigned zoom)
+{
+    if (zoom <= GlobalConstants::LOW_RES_MESH_MAX_ZOOM)
+        return ConfigManager::getInstance()->lowMeshRes();
+    else if (zoom <= GlobalConstants::MEDIUM_RES_MESH_MAX_ZOOM)
+        return ConfigManager::getInstance()->mediumMeshRes();
+    else
+        return ConfigManager::getInstance()->highMeshRes();
+}
+
+/**
+ * @brief LoadWorkerThread::heightmapUrl
+ * @param tileKey
+ * @return
+ */
+std::string LoadWorkerThread::heightmapUrl(XYZTileKey tileKey)
+{
+    return ConfigManager::getInstance()->heightDataServiceUrl()
+        + std::to_string(tileKey.z()) + "/"
+        + std::to_string(tileKey.x()) + "/"
+        + std::to_string(tileKey.y()) + ".webp?key=" + ConfigManager::getInstance()->heightDataServiceKey();
+}
+
+/**
+ * @brief LoadWorkerThread::overlayUrl
+ * @param tileKey
+ * @return
+ */
+std::string LoadWorkerThread::overlayUrl(XYZTileKey tileKey)
+{
+    return ConfigManager::getInstance()->overlayDataServiceUrl()
+        + std::to_string(tileKey.z()) + "/"
+        + std::to_string(tileKey.x()) + "/"
+        + std::to_string(tileKey.y()) + ".jpg?key=" + ConfigManager::getInstance()->overlayDataServiceKey();
+}
+
+/**
+ * @brief LoadWorkerThread::heightmapFilePath
+ *
+ * Location of a heightmap inside the disk cache, see
+ * TerrainManager::initDiskCache for the layout.
+ *
+ * @param tileKey
+ * @return
+ */
+std::string LoadWorkerThread::heightmapFilePath(XYZTileKey tileKey)
+{
+    return ConfigManager::getInstance()->diskCachePath() + GlobalConstants::HEIGHTDATA_DIR_NAME
+        + std::to_string(tileKey.x()) + "_"
+        + std::to_string(tileKey.y()) + "_"
+        + std::to_string(tileKey.z()) + ".webp";
+}
+
+/**
+ * @brief LoadWorkerThread::overlayFilePath
+ * @param tileKey
+ * @return
+ */
+std::string LoadWorkerThread::overlayFilePath(XYZTileKey tileKey)
+{
+    return ConfigManager::getInstance()->diskCachePath() + GlobalConstants::OVERLAY_DIR_NAME
+        + std::to_string(tileKey.x()) + "_"
+        + std::to_string(tileKey.y()) + "_"
+        + std::to_string(tileKey.z()) + ".jpg";
+}
@@ -5,6 +5,7 @@
 #include "terrainnode.h"
 #include "xyztilekey.h"
 #include <curl/curl.h>
+#include <string>
 #include <thread>
 
 enum LoadResponseType {
@@ -20,9 +21,19 @@ enum LoadResponseOrigin {
     LOAD_ORIGIN_API
 };
 
+/* The layers of a tile are returned in separate responses, so that the
+ * heights can be rendered before the overlay arrives. A successful height
+ * response is always followed by an overlay response. */
+enum LoadResponseLayer {
+    LOAD_LAYER_HEIGHT,
+    LOAD_LAYER_OVERLAY
+};
+
 enum LoadRequestType {
     LOAD_REQUEST,
     LOAD_REQUEST_DISK_CACHE,
+    LOAD_REQUEST_PREWARM, /* Only download and persist to the disk cache */
+    LOAD_REQUEST_OVERLAY, /* Only the overlay of a resident node */
     LOAD_STOP_THREAD
 };
 
@@ -30,6 +41,7 @@ struct LoadRequest {
     XYZTileKey tileKey;
     LoadRequestType type;
     bool offlineMode;
+    unsigned priority = 0; /* Lower is more important, see TerrainManager::requestPriority */
 };
 
 /**
@@ -47,6 +59,10 @@ struct LoadResponse {
     int overlayWidth, overlayHeight, overlayNrChannels;
     int heightWidth, heightHeight;
     LoadResponseOrigin origin;
+    LoadResponseLayer layer = LOAD_LAYER_HEIGHT;
+    unsigned char* overlayMipmaps = nullptr; /* Must be deallocated with delete[] overlayMipmaps */
+    unsigned priority = 0; /* Of the request */
+    long httpStatusCode = 0; /* Of a failed API request, 0 for network errors */
 };
 
 /**
@@ -70,6 +86,18 @@ public:
     void loadOverlayFromDisk(LoadRequest& request, LoadResponse& response);
     void loadHeightmapFromApi(LoadRequest& request, LoadResponse& response);
     void loadOverlayFromApi(LoadRequest& request, LoadResponse& response);
+    void prewarmDiskCache(LoadRequest& request, LoadResponse& response);
+
+    static unsigned char* generateMipmaps(const unsigned char* data, int width, int height);
+
+    LoadResponseType downloadFromApi(const std::string& url, std::string& responseData, long& httpStatusCode);
+    bool persistToDiskCache(const std::string& filePath, const std::string& data);
+
+    static unsigned meshResolution(unsigned zoom);
+    static std::string heightmapUrl(XYZTileKey tileKey);
+    static std::string overlayUrl(XYZTileKey tileKey);
+    static std::string heightmapFilePath(XYZTileKey tileKey);
+    static std::string overlayFilePath(XYZTileKey tileKey);
 
     MessageQueue<LoadRequest>* _requestQueue;
     MessageQueue<LoadResponse>* _doneQueue;
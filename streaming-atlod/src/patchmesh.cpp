@@ -0,0 +1,146 @@
+#include "patchmesh.h"
+
+#include "glstatecache.h"
+#include "util.h"
+
+/**
+ * @brief PatchMesh::PatchMesh
+ */
+PatchMesh::PatchMesh() { }
+
+/**
+ * @brief PatchMesh::load
+ */
+void PatchMesh::load()
+{
+    loadVertices();
+    loadIndices();
+}
+
+/**
+ * @brief PatchMesh::render Expects GL_PATCH_VERTICES to be 4
+ */
+void PatchMesh::render()
+{
+    GlStateCache::getInstance()->bindVertexArray(_vao);
+    glDrawElements(GL_PATCHES, _indices.size(), GL_UNSIGNED_INT, (void*)0);
+}
+
+/**
+ * @brief PatchMesh::patchCount
+ * @return
+ */
+unsigned PatchMesh::patchCount() const
+{
+    return _indices.size() / 4;
+}
+
+/**
+ * @brief PatchMesh::loadVertices
+ *
+ * The grid vertices are followed by the skirt vertices, which duplicate the
+ * border clockwise from the top left corner, like in GridMesh.
+ */
+void PatchMesh::loadVertices()
+{
+    unsigned sideLength = PATCHES_PER_SIDE + 1;
+
+    for (unsigned i = 0; i < sideLength; i++) {
+        for (unsigned j = 0; j < sideLength; j++) {
+            _vertices.push_back((float)j / PATCHES_PER_SIDE); /* Position u */
+            _vertices.push_back((float)i / PATCHES_PER_SIDE); /* Position v */
+            _vertices.push_back(0); /* Skirt vertex false */
+        }
+    }
+
+    for (unsigned k = 0; k < 4 * PATCHES_PER_SIDE; k++) {
+        unsigned side = k / PATCHES_PER_SIDE, step = k % PATCHES_PER_SIDE;
+        float t = (float)step / PATCHES_PER_SIDE;
+
+        float u, v;
+        switch (side) {
+        case 0:
+            u = t, v = 0;
+            break;
+        case 1:
+            u = 1, v = t;
+            break;
+        case 2:
+            u = 1 - t, v = 1;
+            break;
+        default:
+            u = 0, v = 1 - t;
+            break;
+        }
+
+        _vertices.push_back(u); /* Position u */
+        _vertices.push_back(v); /* Position v */
+        _vertices.push_back(1); /* Skirt vertex true */
+    }
+
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+
+    glGenBuffers(1, &_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(float), &_vertices[0], GL_STATIC_DRAW);
+
+    /* Position and skirt flag attribute */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    Util::checkGlError("PATCHMESH VAO LOAD FAILED");
+}
+
+/**
+ * @brief PatchMesh::loadIndices
+ */
+void PatchMesh::loadIndices()
+{
+    unsigned sideLength = PATCHES_PER_SIDE + 1;
+
+    for (unsigned i = 0; i < PATCHES_PER_SIDE; i++) {
+        for (unsigned j = 0; j < PATCHES_PER_SIDE; j++) {
+            _indices.push_back(j + sideLength * i);
+            _indices.push_back(j + 1 + sideLength * i);
+            _indices.push_back(j + 1 + sideLength * (i + 1));
+            _indices.push_back(j + sideLength * (i + 1));
+        }
+    }
+
+    /* Border vertex of the grid for each skirt vertex */
+    unsigned ringLength = 4 * PATCHES_PER_SIDE;
+    unsigned firstSkirtVertex = sideLength * sideLength;
+    std::vector<unsigned> border;
+
+    for (unsigned j = 0; j < PATCHES_PER_SIDE; j++)
+        border.push_back(j);
+    for (unsigned i = 0; i < PATCHES_PER_SIDE; i++)
+        border.push_back(PATCHES_PER_SIDE + sideLength * i);
+    for (unsigned j = PATCHES_PER_SIDE; j > 0; j--)
+        border.push_back(j + sideLength * PATCHES_PER_SIDE);
+    for (unsigned i = PATCHES_PER_SIDE; i > 0; i--)
+        border.push_back(sideLength * i);
+
+    for (unsigned k = 0; k < ringLength; k++) {
+        unsigned next = (k + 1) % ringLength;
+        _indices.push_back(firstSkirtVertex + k);
+        _indices.push_back(firstSkirtVertex + next);
+        _indices.push_back(border[next]);
+        _indices.push_back(border[k]);
+    }
+
+    glGenBuffers(1, &_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(unsigned), &_indices[0], GL_STATIC_DRAW);
+
+    Util::checkGlError("PATCHMESH EBO LOAD FAILED");
+}
+
+/**
+ * @brief PatchMesh::unload
+ */
+void PatchMesh::unload()
+{
+    /* TODO */
+}
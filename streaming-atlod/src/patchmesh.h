@@ -0,0 +1,40 @@
+#ifndef PATCHMESH_H
+#define PATCHMESH_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+/**
+ * @brief Coarse grid of quad patches for the tessellation path, with a ring
+ *        of skirt patches around it.
+ *
+ * The vertices are in normalized tile coordinates with a skirt flag, each
+ * patch has four vertices in the order (u, v) = (0, 0), (1, 0), (1, 1),
+ * (0, 1). The skirt patches have their lowered edge at v = 0.
+ */
+class PatchMesh
+{
+public:
+    /* Together with the maximum tessellation level of 64, this gives one
+     * vertex per heightmap pixel at full detail */
+    static constexpr unsigned PATCHES_PER_SIDE = 8;
+
+    PatchMesh();
+    void load();
+    void render();
+    void unload();
+
+    unsigned patchCount() const;
+
+    // private:
+    std::vector<unsigned> _indices;
+    std::vector<float> _vertices;
+    unsigned _vao, _vbo, _ebo;
+
+    void loadVertices();
+    void loadIndices();
+};
+
+#endif // PATCHMESH_H
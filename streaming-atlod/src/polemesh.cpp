@@ -1,6 +1,7 @@
 #include "polemesh.h"
 
 #include "glm/ext/scalar_constants.hpp"
+#include "glstatecache.h"
 #include "util.h"
 #include <glm/glm.hpp>
 #include <iostream>
@@ -17,15 +18,10 @@ void PoleMesh::load()
 }
 void PoleMesh::render()
 {
-    Util::checkGlError("hmm");
-    glEnable(GL_PRIMITIVE_RESTART);
-    glPrimitiveRestartIndex(RESTART_INDEX);
-    Util::checkGlError("PRIMITIVE RESTART");
-    glBindVertexArray(_vao);
-    Util::checkGlError("VAO");
-    glDrawElements(GL_TRIANGLE_STRIP, _indices.size() * sizeof(unsigned int), GL_UNSIGNED_INT, (void*)0);
+    GlStateCache::getInstance()->setPrimitiveRestart(true, RESTART_INDEX);
+    GlStateCache::getInstance()->bindVertexArray(_vao);
+    glDrawElements(GL_TRIANGLE_STRIP, _indices.size(), GL_UNSIGNED_INT, (void*)0);
     Util::checkGlError("DRAW FAILED");
-    glDisable(GL_PRIMITIVE_RESTART);
 }
 
 void PoleMesh::unload()
@@ -0,0 +1,467 @@
+#include "prewarm.h"
+
+#include "configmanager.h"
+#include "globalconstants.h"
+#include "loadworkerthread.h"
+#include "messagequeue.h"
+#include "xyztilekey.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+namespace Prewarm {
+
+/* Latitude cutoff of Web Mercator */
+const double MAX_LATITUDE = 85.0511;
+const double PI = 3.14159265358979323846;
+
+/* After a network error, no new requests are dispatched for a while, same as
+ * the offline wait of the terrain manager */
+const unsigned OFFLINE_WAIT_SECONDS = 5;
+
+/* A worker answers all remaining requests of its current batch with an error
+ * after a network error, so the number of requests per worker in flight
+ * bounds how many tiles fail at once while offline */
+const unsigned DEFAULT_MAX_IN_FLIGHT_PER_WORKER = 4;
+const unsigned MAX_MAX_IN_FLIGHT_PER_WORKER = 64;
+
+const unsigned MAX_NUM_WORKERS = 16;
+
+std::string configPath;
+
+double minLon, minLat, maxLon, maxLat;
+unsigned minZoom, maxZoom;
+unsigned numWorkers = 0; /* Defaults to the number of load workers of the config */
+double maxTilesPerSecond = 0.0; /* 0 disables the rate limit */
+unsigned maxInFlightPerWorker = DEFAULT_MAX_IN_FLIGHT_PER_WORKER;
+
+MessageQueue<LoadResponse>* doneQueue;
+std::vector<MessageQueue<LoadRequest>*> requestQueues;
+std::vector<LoadWorkerThread*> workers;
+
+/* Contains tile keys the API does not serve, so that their descendants do
+ * not have to be requested at all (e.g. oceans at high zoom levels). */
+std::unordered_set<XYZTileKey> unloadableTileKeys;
+
+std::chrono::steady_clock::time_point offlineWaitUntil;
+
+unsigned numDownloaded = 0;
+unsigned numSkipped = 0;
+unsigned numUnloadable = 0;
+unsigned numFailed = 0;
+unsigned apiRequests = 0;
+
+/**
+ * @brief printUsage
+ */
+void printUsage()
+{
+    std::cerr << "Usage: streaming-atlod-prewarm <config-file> <min-lon> <min-lat> <max-lon> <max-lat> "
+              << "<min-zoom> <max-zoom> [num-workers] [max-tiles-per-second] [max-in-flight-per-worker]" << std::endl;
+}
+
+/**
+ * @brief tryParsingDouble
+ * @param property
+ * @param value
+ * @param errorMessage
+ * @return
+ */
+bool tryParsingDouble(double& property, std::string value, std::string errorMessage)
+{
+    try {
+        property = std::stod(value);
+        return false;
+    } catch (...) {
+        std::cerr << errorMessage << std::endl;
+        return true;
+    }
+}
+
+/**
+ * @brief tryParsingUnsigned
+ * @param property
+ * @param value
+ * @param errorMessage
+ * @return
+ */
+bool tryParsingUnsigned(unsigned& property, std::string value, std::string errorMessage)
+{
+    try {
+        property = std::stoul(value);
+        return false;
+    } catch (...) {
+        std::cerr << errorMessage << std::endl;
+        return true;
+    }
+}
+
+/**
+ * @brief parseArgs
+ * @param argc
+ * @param argv
+ */
+void parseArgs(int argc, char** argv)
+{
+    if (argc < 8 || argc > 11) {
+        printUsage();
+        std::exit(1);
+    }
+
+    bool shouldExit = false;
+
+    configPath = std::string(argv[1]);
+    shouldExit |= tryParsingDouble(minLon, argv[2], "Minimum longitude must be a number");
+    shouldExit |= tryParsingDouble(minLat, argv[3], "Minimum latitude must be a number");
+    shouldExit |= tryParsingDouble(maxLon, argv[4], "Maximum longitude must be a number");
+    shouldExit |= tryParsingDouble(maxLat, argv[5], "Maximum latitude must be a number");
+    shouldExit |= tryParsingUnsigned(minZoom, argv[6], "Minimum zoom level must be an unsigned integer");
+    shouldExit |= tryParsingUnsigned(maxZoom, argv[7], "Maximum zoom level must be an unsigned integer");
+
+    if (argc >= 9)
+        shouldExit |= tryParsingUnsigned(numWorkers, argv[8], "Number of workers must be an unsigned integer");
+
+    if (argc >= 10)
+        shouldExit |= tryParsingDouble(maxTilesPerSecond, argv[9], "Maximum tiles per second must be a number");
+
+    if (argc >= 11)
+        shouldExit |= tryParsingUnsigned(maxInFlightPerWorker, argv[10], "Maximum requests in flight per worker must be an unsigned integer");
+
+    if (shouldExit) {
+        printUsage();
+        std::exit(1);
+    }
+
+    /* A minimum longitude larger than the maximum crosses the antimeridian */
+    if (minLon < -180.0 || minLon > 180.0 || maxLon < -180.0 || maxLon > 180.0) {
+        std::cerr << "Longitudes must be between -180 and 180" << std::endl;
+        shouldExit = true;
+    }
+
+    if (minLat < -90.0 || maxLat > 90.0 || minLat > maxLat) {
+        std::cerr << "Latitudes must be between -90 and 90, with the minimum not larger than the maximum" << std::endl;
+        shouldExit = true;
+    }
+
+    if (minZoom > maxZoom) {
+        std::cerr << "The minimum zoom level must not be larger than the maximum zoom level" << std::endl;
+        shouldExit = true;
+    }
+
+    if (argc >= 9 && (numWorkers < 1 || numWorkers > MAX_NUM_WORKERS)) {
+        std::cerr << "Number of workers must be between 1 and " << MAX_NUM_WORKERS << std::endl;
+        shouldExit = true;
+    }
+
+    if (maxTilesPerSecond < 0.0) {
+        std::cerr << "Maximum tiles per second must not be negative" << std::endl;
+        shouldExit = true;
+    }
+
+    if (maxInFlightPerWorker < 1 || maxInFlightPerWorker > MAX_MAX_IN_FLIGHT_PER_WORKER) {
+        std::cerr << "Maximum requests in flight per worker must be between 1 and " << MAX_MAX_IN_FLIGHT_PER_WORKER << std::endl;
+        shouldExit = true;
+    }
+
+    if (shouldExit) {
+        std::exit(1);
+    }
+}
+
+/**
+ * @brief lonToTileX
+ * @param lon
+ * @param zoom
+ * @return
+ */
+unsigned lonToTileX(double lon, unsigned zoom)
+{
+    long n = 1L << zoom;
+    long x = (long)std::floor((lon + 180.0) / 360.0 * n);
+    return (unsigned)std::clamp(x, 0L, n - 1);
+}
+
+/**
+ * @brief latToTileY
+ * @param lat
+ * @param zoom
+ * @return
+ */
+unsigned latToTileY(double lat, unsigned zoom)
+{
+    long n = 1L << zoom;
+    double latRad = std::clamp(lat, -MAX_LATITUDE, MAX_LATITUDE) * PI / 180.0;
+    long y = (long)std::floor((1.0 - std::log(std::tan(latRad) + 1.0 / std::cos(latRad)) / PI) / 2.0 * n);
+    return (unsigned)std::clamp(y, 0L, n - 1);
+}
+
+/**
+ * @brief tileXRanges
+ *
+ * A region crossing the antimeridian is split into one range on each side
+ * of it. At zoom levels where both sides share a tile, the ranges cover the
+ * whole row.
+ *
+ * @param zoom
+ * @return Inclusive ranges of tile x coordinates
+ */
+std::vector<std::pair<unsigned, unsigned>> tileXRanges(unsigned zoom)
+{
+    unsigned minX = lonToTileX(minLon, zoom), maxX = lonToTileX(maxLon, zoom);
+
+    if (minLon <= maxLon)
+        return { { minX, maxX } };
+
+    unsigned lastX = (1u << zoom) - 1;
+    if (minX <= maxX)
+        return { { 0, lastX } };
+
+    return { { minX, lastX }, { 0, maxX } };
+}
+
+/**
+ * @brief numberOfTilesInRegion
+ * @return
+ */
+unsigned long numberOfTilesInRegion()
+{
+    unsigned long numTiles = 0;
+    for (unsigned zoom = minZoom; zoom <= maxZoom; zoom++) {
+        unsigned long height = latToTileY(minLat, zoom) - latToTileY(maxLat, zoom) + 1;
+        for (auto [minX, maxX] : tileXRanges(zoom))
+            numTiles += (maxX - minX + 1ul) * height;
+    }
+    return numTiles;
+}
+
+/**
+ * @brief isCached
+ *
+ * A tile is only indexed by the disk cache if both layers exist, which makes
+ * the prewarming resumable: tiles are simply skipped on the next run.
+ *
+ * @param tileKey
+ * @return
+ */
+bool isCached(XYZTileKey tileKey)
+{
+    return std::filesystem::exists(LoadWorkerThread::heightmapFilePath(tileKey))
+        && std::filesystem::exists(LoadWorkerThread::overlayFilePath(tileKey));
+}
+
+/**
+ * @brief hasUnloadableAncestor
+ * @param tileKey
+ * @return
+ */
+bool hasUnloadableAncestor(XYZTileKey tileKey)
+{
+    unsigned x = tileKey.x(), y = tileKey.y(), z = tileKey.z();
+    while (z > minZoom) {
+        x /= 2;
+        y /= 2;
+        z--;
+        if (unloadableTileKeys.count(XYZTileKey(x, y, z)))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief setup
+ */
+void setup()
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    ConfigManager::getInstance()->loadConfig(configPath);
+
+    if (maxZoom > (unsigned)ConfigManager::getInstance()->maxZoom()) {
+        std::cerr << "The maximum zoom level must not be larger than the maximum zoom level of the config ("
+                  << ConfigManager::getInstance()->maxZoom() << ")" << std::endl;
+        std::exit(1);
+    }
+
+    if (numWorkers == 0)
+        numWorkers = ConfigManager::getInstance()->numLoadWorkers();
+
+    /* Create disk cache folders if they don't exist yet */
+    std::string cacheLocation = ConfigManager::getInstance()->diskCachePath();
+    std::filesystem::create_directories(cacheLocation + GlobalConstants::HEIGHTDATA_DIR_NAME);
+    std::filesystem::create_directories(cacheLocation + GlobalConstants::OVERLAY_DIR_NAME);
+
+    doneQueue = new MessageQueue<LoadResponse>;
+
+    for (unsigned i = 0; i < numWorkers; i++) {
+        MessageQueue<LoadRequest>* requestQueue = new MessageQueue<LoadRequest>;
+        requestQueues.push_back(requestQueue);
+        workers.push_back(new LoadWorkerThread(requestQueue, doneQueue));
+        workers.back()->startInAnotherThread();
+    }
+}
+
+/**
+ * @brief processResponses
+ * @return Number of processed responses
+ */
+unsigned processResponses()
+{
+    std::deque<LoadResponse> responses = doneQueue->popAll();
+
+    for (auto& response : responses) {
+        switch (response.type) {
+        case LOAD_OK:
+            numDownloaded++;
+            apiRequests += 2;
+            break;
+        case LOAD_UNLOADABLE:
+            /* Without an overlay the tile cannot be cached, but its
+             * children might still have one */
+            if (response.layer == LOAD_LAYER_HEIGHT)
+                unloadableTileKeys.insert(response.tileKey);
+            numUnloadable++;
+            break;
+        case LOAD_ERROR:
+            /* Other status codes are answered by a reachable API */
+            if (response.httpStatusCode == 0)
+                offlineWaitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(OFFLINE_WAIT_SECONDS);
+            numFailed++;
+            break;
+        case LOAD_TIMEOUT:
+            numFailed++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return responses.size();
+}
+
+/**
+ * @brief prewarmZoomLevel
+ *
+ * Zoom levels are processed one after another, so that the children of tiles
+ * which turned out to be unloadable are never requested.
+ *
+ * @param zoom
+ */
+void prewarmZoomLevel(unsigned zoom)
+{
+    unsigned minY = latToTileY(maxLat, zoom), maxY = latToTileY(minLat, zoom);
+
+    std::vector<XYZTileKey> pending;
+    unsigned numSkippedBefore = numSkipped;
+
+    for (unsigned y = minY; y <= maxY; y++) {
+        for (auto [minX, maxX] : tileXRanges(zoom)) {
+            for (unsigned x = minX; x <= maxX; x++) {
+                XYZTileKey tileKey(x, y, zoom);
+                if (isCached(tileKey)) {
+                    numSkipped++;
+                } else if (hasUnloadableAncestor(tileKey)) {
+                    unloadableTileKeys.insert(tileKey);
+                    numUnloadable++;
+                } else {
+                    pending.push_back(tileKey);
+                }
+            }
+        }
+    }
+
+    std::cout << "Zoom level " << zoom << ": " << pending.size() << " tiles to download, "
+              << numSkipped - numSkippedBefore << " already cached" << std::endl;
+
+    auto dispatchInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(maxTilesPerSecond > 0.0 ? 1.0 / maxTilesPerSecond : 0.0));
+    auto nextDispatch = std::chrono::steady_clock::now();
+
+    size_t next = 0;
+    unsigned inFlight = 0;
+    unsigned currentWorker = 0;
+
+    while (next < pending.size() || inFlight > 0) {
+        inFlight -= processResponses();
+
+        auto now = std::chrono::steady_clock::now();
+        if (next < pending.size()
+            && inFlight < numWorkers * maxInFlightPerWorker
+            && now >= nextDispatch
+            && now >= offlineWaitUntil) {
+            requestQueues[currentWorker]->push({ pending[next], LOAD_REQUEST_PREWARM, false });
+            currentWorker = (currentWorker + 1) % numWorkers;
+            nextDispatch = std::max(nextDispatch, now) + dispatchInterval;
+            inFlight++;
+            next++;
+            continue;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/**
+ * @brief run
+ */
+void run()
+{
+    unsigned long numTiles = numberOfTilesInRegion();
+    std::cout << "Prewarming " << numTiles << " tiles with " << numWorkers << " workers" << std::endl;
+
+    if (numTiles > (unsigned long)ConfigManager::getInstance()->diskCacheSize()) {
+        std::cerr << "Warning: The region contains more tiles than the disk cache capacity ("
+                  << ConfigManager::getInstance()->diskCacheSize()
+                  << "), tiles will be evicted again on the next start up" << std::endl;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned zoom = minZoom; zoom <= maxZoom; zoom++) {
+        prewarmZoomLevel(zoom);
+    }
+
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Done after " << seconds << " s: "
+              << numDownloaded << " downloaded, "
+              << numSkipped << " already cached, "
+              << numUnloadable << " unloadable, "
+              << numFailed << " failed (" << apiRequests << " API requests)" << std::endl;
+
+    if (numFailed > 0) {
+        std::cout << "Run the same command again to retry the failed tiles" << std::endl;
+    }
+}
+
+/**
+ * @brief shutDown
+ */
+void shutDown()
+{
+    for (auto* requestQueue : requestQueues) {
+        requestQueue->push({ XYZTileKey(0, 0, 0), LOAD_STOP_THREAD, false });
+    }
+
+    /* Wait until all workers acknowledged the stop request */
+    unsigned numStopped = 0;
+    while (numStopped < numWorkers) {
+        for (auto& response : doneQueue->popAll()) {
+            if (response.type == LOAD_STOPPED_THREAD)
+                numStopped++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    curl_global_cleanup();
+}
+}
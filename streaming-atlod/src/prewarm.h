@@ -0,0 +1,19 @@
+#ifndef PREWARM_H
+#define PREWARM_H
+
+/**
+ * Headless tool for filling the disk cache with all tiles of a region ahead
+ * of time, e.g. before deploying to a site with limited connectivity.
+ *
+ * The tiles are downloaded by regular load worker threads and stored in the
+ * same layout that TerrainManager::initDiskCache reads on start up.
+ */
+namespace Prewarm {
+
+void parseArgs(int argc, char** argv);
+void setup();
+void run();
+void shutDown();
+}
+
+#endif // PREWARM_H
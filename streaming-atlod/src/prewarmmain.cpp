@@ -0,0 +1,11 @@
+#include "prewarm.h"
+
+int main(int argc, char** argv)
+{
+    Prewarm::parseArgs(argc, argv);
+    Prewarm::setup();
+    Prewarm::run();
+    Prewarm::shutDown();
+
+    return 0;
+}
@@ -7,12 +7,27 @@
 struct RenderStatistics {
     unsigned renderedTriangles = 0;
     unsigned drawCalls = 0;
+    unsigned submitMicros = 0; /* CPU time for issuing the terrain draw calls */
+    bool multiDrawIndirect = false;
+    unsigned filteredStateChanges = 0; /* Redundant GL calls skipped by the state cache */
+    bool pipelineStatistics = false;
+    unsigned vertexShaderInvocations = 0; /* Of the terrain, a few frames old */
     unsigned apiRequests = 0;
     unsigned numberOfNodes = 0;
     unsigned deepestZoomLevel = 0;
     unsigned currentlyRequested = 0;
+    unsigned pendingUploads = 0;
+    unsigned integrationBacklog = 0;
     unsigned visibleNodes = 0;
     unsigned traversedNodes = 0;
+    unsigned reusedSubtrees = 0; /* Whose traversal output was copied from the last frame */
+    unsigned traversalMicros = 0; /* CPU time for updating the LOD cut */
+    unsigned planeTestsSaved = 0;
+    unsigned memoizedDecisions = 0;
+    bool lodCutReused = false;
+    unsigned traversalTasks = 0;
+    unsigned culledChildren = 0;
+    unsigned skipLevelRequests = 0;
     unsigned numberOfDiskCacheEntries = 0;
     bool waitOffline = false;
 };
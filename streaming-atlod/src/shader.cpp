@@ -1,4 +1,5 @@
 #include "shader.h"
+#include "glstatecache.h"
 
 Shader::Shader() { }
 
@@ -10,15 +11,43 @@ Shader::Shader() { }
  */
 Shader::Shader(const char* vertexPath, const char* fragmentPath)
 {
-    int success;
-    char info[512];
     int vertexId = loadShaderProgram(vertexPath, GL_VERTEX_SHADER);
     int fragmentId = loadShaderProgram(fragmentPath, GL_FRAGMENT_SHADER);
 
+    linkProgram({ vertexId, fragmentId });
+}
+
+/**
+ * @brief Shader::Shader Program with tessellation stages
+ *
+ * @param vertexPath
+ * @param tessControlPath
+ * @param tessEvaluationPath
+ * @param fragmentPath
+ */
+Shader::Shader(const char* vertexPath, const char* tessControlPath, const char* tessEvaluationPath, const char* fragmentPath)
+{
+    int vertexId = loadShaderProgram(vertexPath, GL_VERTEX_SHADER);
+    int tessControlId = loadShaderProgram(tessControlPath, GL_TESS_CONTROL_SHADER);
+    int tessEvaluationId = loadShaderProgram(tessEvaluationPath, GL_TESS_EVALUATION_SHADER);
+    int fragmentId = loadShaderProgram(fragmentPath, GL_FRAGMENT_SHADER);
+
+    linkProgram({ vertexId, tessControlId, tessEvaluationId, fragmentId });
+}
+
+/**
+ * @brief Shader::linkProgram
+ * @param shaderIds Compiled shaders, deleted after linking
+ */
+void Shader::linkProgram(std::initializer_list<int> shaderIds)
+{
+    int success;
+    char info[512];
+
     /* Create and link shader program */
     _id = glCreateProgram();
-    glAttachShader(_id, vertexId);
-    glAttachShader(_id, fragmentId);
+    for (int shaderId : shaderIds)
+        glAttachShader(_id, shaderId);
     glLinkProgram(_id);
 
     /* Check linking errors */
@@ -32,8 +61,69 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
     }
 
     /* Shaders are linked, therefore no longer necessary, delete them */
-    glDeleteShader(vertexId);
-    glDeleteShader(fragmentId);
+    for (int shaderId : shaderIds)
+        glDeleteShader(shaderId);
+
+    resolveUniformLocations();
+}
+
+/**
+ * @brief Shader::resolveUniformLocations Queries the locations of all active
+ *        uniforms, so that setting a uniform does not need a string lookup in
+ *        the driver. Uniforms inside a uniform block have no location and are
+ *        skipped.
+ */
+void Shader::resolveUniformLocations()
+{
+    GLint numberOfUniforms = 0, maxNameLength = 0;
+    glGetProgramiv(_id, GL_ACTIVE_UNIFORMS, &numberOfUniforms);
+    glGetProgramiv(_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    std::string name(maxNameLength, '\0');
+
+    for (GLint i = 0; i < numberOfUniforms; i++) {
+        GLsizei length = 0;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(_id, i, maxNameLength, &length, &size, &type, &name[0]);
+
+        std::string uniformName = name.substr(0, length);
+        int location = glGetUniformLocation(_id, uniformName.c_str());
+        if (location < 0)
+            continue;
+
+        /* Arrays are reported as "name[0]", also make them reachable by name */
+        std::size_t bracket = uniformName.find('[');
+        if (bracket != std::string::npos)
+            uniformName = uniformName.substr(0, bracket);
+
+        _uniformLocations[uniformName] = location;
+    }
+}
+
+/**
+ * @brief Shader::uniformLocation
+ * @param name
+ * @return The cached location, -1 if the uniform is not active, in which case
+ *         setting it is silently ignored by OpenGL
+ */
+int Shader::uniformLocation(const std::string& name) const
+{
+    auto it = _uniformLocations.find(name);
+    return it == _uniformLocations.end() ? -1 : it->second;
+}
+
+/**
+ * @brief Shader::bindUniformBlock Assigns a uniform block to a binding point,
+ *        does nothing if the program does not use the block.
+ * @param name
+ * @param binding
+ */
+void Shader::bindUniformBlock(const std::string& name, unsigned binding) const
+{
+    GLuint blockIndex = glGetUniformBlockIndex(_id, name.c_str());
+    if (blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(_id, blockIndex, binding);
 }
 
 /**
@@ -104,7 +194,7 @@ void Shader::handleErrors()
  */
 void Shader::use()
 {
-    glUseProgram(this->_id);
+    GlStateCache::getInstance()->useProgram(_id);
 }
 
 /**
@@ -123,7 +213,7 @@ unsigned int Shader::id() const
  */
 void Shader::setBool(const std::string& name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(_id, name.c_str()), (int)value);
+    glUniform1i(uniformLocation(name), (int)value);
 }
 
 /**
@@ -133,7 +223,7 @@ void Shader::setBool(const std::string& name, bool value) const
  */
 void Shader::setInt(const std::string& name, int value) const
 {
-    glUniform1i(glGetUniformLocation(_id, name.c_str()), value);
+    glUniform1i(uniformLocation(name), value);
 }
 
 /**
@@ -143,7 +233,7 @@ void Shader::setInt(const std::string& name, int value) const
  */
 void Shader::setFloat(const std::string& name, float value) const
 {
-    glUniform1f(glGetUniformLocation(_id, name.c_str()), value);
+    glUniform1f(uniformLocation(name), value);
 }
 
 /**
@@ -153,7 +243,7 @@ void Shader::setFloat(const std::string& name, float value) const
  */
 void Shader::setVec2(const std::string& name, const glm::vec2& value) const
 {
-    glUniform2fv(glGetUniformLocation(_id, name.c_str()), 1, &value[0]);
+    glUniform2fv(uniformLocation(name), 1, &value[0]);
 }
 
 /**
@@ -164,7 +254,7 @@ void Shader::setVec2(const std::string& name, const glm::vec2& value) const
  */
 void Shader::setVec2(const std::string& name, float x, float y) const
 {
-    glUniform2f(glGetUniformLocation(_id, name.c_str()), x, y);
+    glUniform2f(uniformLocation(name), x, y);
 }
 
 /**
@@ -174,7 +264,7 @@ void Shader::setVec2(const std::string& name, float x, float y) const
  */
 void Shader::setVec3(const std::string& name, const glm::vec3& value) const
 {
-    glUniform3fv(glGetUniformLocation(_id, name.c_str()), 1, &value[0]);
+    glUniform3fv(uniformLocation(name), 1, &value[0]);
 }
 
 /**
@@ -186,7 +276,7 @@ void Shader::setVec3(const std::string& name, const glm::vec3& value) const
  */
 void Shader::setVec3(const std::string& name, float x, float y, float z) const
 {
-    glUniform3f(glGetUniformLocation(_id, name.c_str()), x, y, z);
+    glUniform3f(uniformLocation(name), x, y, z);
 }
 
 /**
@@ -196,7 +286,7 @@ void Shader::setVec3(const std::string& name, float x, float y, float z) const
  */
 void Shader::setVec4(const std::string& name, const glm::vec4& value) const
 {
-    glUniform4fv(glGetUniformLocation(_id, name.c_str()), 1, &value[0]);
+    glUniform4fv(uniformLocation(name), 1, &value[0]);
 }
 
 /**
@@ -209,7 +299,7 @@ void Shader::setVec4(const std::string& name, const glm::vec4& value) const
  */
 void Shader::setVec4(const std::string& name, float x, float y, float z, float w) const
 {
-    glUniform4f(glGetUniformLocation(_id, name.c_str()), x, y, z, w);
+    glUniform4f(uniformLocation(name), x, y, z, w);
 }
 
 /**
@@ -219,7 +309,7 @@ void Shader::setVec4(const std::string& name, float x, float y, float z, float w
  */
 void Shader::setMat2(const std::string& name, const glm::mat2& mat) const
 {
-    glUniformMatrix2fv(glGetUniformLocation(_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix2fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 /**
@@ -229,7 +319,7 @@ void Shader::setMat2(const std::string& name, const glm::mat2& mat) const
  */
 void Shader::setMat3(const std::string& name, const glm::mat3& mat) const
 {
-    glUniformMatrix3fv(glGetUniformLocation(_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix3fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 /**
@@ -239,5 +329,65 @@ void Shader::setMat3(const std::string& name, const glm::mat3& mat) const
  */
 void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+/**
+ * @brief Shader::setInt
+ * @param location
+ * @param value
+ */
+void Shader::setInt(int location, int value) const
+{
+    glUniform1i(location, value);
+}
+
+/**
+ * @brief Shader::setFloat
+ * @param location
+ * @param value
+ */
+void Shader::setFloat(int location, float value) const
+{
+    glUniform1f(location, value);
+}
+
+/**
+ * @brief Shader::setVec2
+ * @param location
+ * @param value
+ */
+void Shader::setVec2(int location, const glm::vec2& value) const
+{
+    glUniform2fv(location, 1, &value[0]);
+}
+
+/**
+ * @brief Shader::setVec3
+ * @param location
+ * @param value
+ */
+void Shader::setVec3(int location, const glm::vec3& value) const
+{
+    glUniform3fv(location, 1, &value[0]);
+}
+
+/**
+ * @brief Shader::setVec4
+ * @param location
+ * @param value
+ */
+void Shader::setVec4(int location, const glm::vec4& value) const
+{
+    glUniform4fv(location, 1, &value[0]);
+}
+
+/**
+ * @brief Shader::setMat4
+ * @param location
+ * @param mat
+ */
+void Shader::setMat4(int location, const glm::mat4& mat) const
+{
+    glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
 }
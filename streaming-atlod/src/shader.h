@@ -6,9 +6,11 @@
 #include <glm/glm.hpp>
 
 #include <fstream>
+#include <initializer_list>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 
 /* The basic structure of this class is based on the Shader class from
  * learnopengl.com. */
@@ -16,6 +18,7 @@ class Shader {
 public:
     Shader();
     Shader(const char* vertexPath, const char* fragmentPath);
+    Shader(const char* vertexPath, const char* tessControlPath, const char* tessEvaluationPath, const char* fragmentPath);
     void use();
     unsigned int id() const;
     void setBool(const std::string& name, bool value) const;
@@ -31,9 +34,24 @@ public:
     void setMat3(const std::string& name, const glm::mat3& mat) const;
     void setMat4(const std::string& name, const glm::mat4& mat) const;
 
+    int uniformLocation(const std::string& name) const;
+    void setInt(int location, int value) const;
+    void setFloat(int location, float value) const;
+    void setVec2(int location, const glm::vec2& value) const;
+    void setVec3(int location, const glm::vec3& value) const;
+    void setVec4(int location, const glm::vec4& value) const;
+    void setMat4(int location, const glm::mat4& mat) const;
+    void bindUniformBlock(const std::string& name, unsigned binding) const;
+
 private:
     unsigned int _id;
+
+    /* Locations of the active uniforms, resolved once after linking */
+    std::unordered_map<std::string, int> _uniformLocations;
+
     void handleErrors();
+    void linkProgram(std::initializer_list<int> shaderIds);
+    void resolveUniformLocations();
     int loadShaderProgram(const char* path, GLenum type);
 };
 
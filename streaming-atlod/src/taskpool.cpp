@@ -0,0 +1,94 @@
+#include "taskpool.h"
+
+/**
+ * @brief TaskPool::TaskPool
+ * @param numThreads Number of threads in addition to the calling thread
+ */
+TaskPool::TaskPool(unsigned numThreads)
+{
+    _threads.reserve(numThreads);
+
+    for (unsigned i = 0; i < numThreads; i++)
+        _threads.emplace_back(&TaskPool::workerLoop, this);
+}
+
+/**
+ * @brief TaskPool::~TaskPool
+ */
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _taskAvailable.notify_all();
+
+    for (auto& thread : _threads)
+        thread.join();
+}
+
+/**
+ * @brief TaskPool::run Runs task(0) to task(numTasks - 1) and waits until all
+ *                      of them are done. Must only be called from one thread
+ *                      at a time.
+ * @param numTasks
+ * @param task
+ */
+void TaskPool::run(unsigned numTasks, const std::function<void(unsigned)>& task)
+{
+    if (numTasks == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _task = &task;
+    _numTasks = numTasks;
+    _nextTask = 0;
+    _finishedTasks = 0;
+    _taskAvailable.notify_all();
+
+    /* Help out instead of idling */
+    while (_nextTask < _numTasks) {
+        unsigned index = _nextTask++;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        _finishedTasks++;
+    }
+
+    _batchDone.wait(lock, [this] { return _finishedTasks == _numTasks; });
+    _task = nullptr;
+}
+
+/**
+ * @brief TaskPool::numThreads
+ * @return
+ */
+unsigned TaskPool::numThreads() const
+{
+    return _threads.size();
+}
+
+/**
+ * @brief TaskPool::workerLoop
+ */
+void TaskPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _taskAvailable.wait(lock, [this] { return _stop || _nextTask < _numTasks; });
+
+        if (_stop)
+            return;
+
+        unsigned index = _nextTask++;
+        const std::function<void(unsigned)>* task = _task;
+        lock.unlock();
+        (*task)(index);
+        lock.lock();
+
+        if (++_finishedTasks == _numTasks)
+            _batchDone.notify_one();
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Small pool of threads for running a batch of independent tasks.
+ *
+ * A batch is started with run(), which blocks until every task of the batch
+ * is done. The calling thread takes part in processing the batch, so a pool
+ * with N threads runs up to N + 1 tasks at once. Tasks are claimed in order
+ * of their index, but may finish in any order.
+ */
+class TaskPool {
+public:
+    TaskPool(unsigned numThreads);
+    ~TaskPool();
+
+    TaskPool(TaskPool& other) = delete;
+    void operator=(const TaskPool&) = delete;
+
+    void run(unsigned numTasks, const std::function<void(unsigned)>& task);
+    unsigned numThreads() const;
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _taskAvailable;
+    std::condition_variable _batchDone;
+
+    const std::function<void(unsigned)>* _task = nullptr;
+    unsigned _numTasks = 0;
+    unsigned _nextTask = 0;
+    unsigned _finishedTasks = 0;
+    bool _stop = false;
+};
+
+#endif // TASKPOOL_H
@@ -4,32 +4,90 @@
 
 #include "../stb_image.h"
 #include "configmanager.h"
+#include "glstatecache.h"
 #include "globalconstants.h"
 #include "mapprojections.h"
 #include "util.h"
 #include <algorithm>
 #include <filesystem>
+#include <glm/gtc/constants.hpp>
+#include <limits>
 #include <regex>
 
 /**
  * @brief TerrainManager::TerrainManager
  */
-TerrainManager::TerrainManager(RenderStatistics& stats, unsigned lowResMesh, unsigned mediumResMesh, unsigned highResMesh, unsigned memCacheSize, unsigned diskCacheSize)
-    : _stats(stats)
-    , _memoryCache(ConfigManager::getInstance()->memoryCacheSize())
+TerrainManager::TerrainManager(RenderStatistics& stats)
+    : _memoryCache(ConfigManager::getInstance()->memoryCacheSize())
     , _diskCache(ConfigManager::getInstance()->diskCacheSize())
+    , _stats(stats)
 {
     std::string dataPath = ConfigManager::getInstance()->dataPath();
 
+    _tessellationEdgeLength = ConfigManager::getInstance()->tessellation();
+
+    /* Vertex shaders may not support storage buffers even with OpenGL 4.3 */
+    if (ConfigManager::getInstance()->multiDrawIndirect() && _tessellationEdgeLength > 0) {
+        std::cerr << "Multi-draw indirect is not used together with tessellation" << std::endl;
+    } else if (ConfigManager::getInstance()->multiDrawIndirect()) {
+        GLint vertexStorageBlocks = 0;
+        if (GLEW_VERSION_4_3)
+            glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertexStorageBlocks);
+
+        _multiDrawIndirect = vertexStorageBlocks > 0;
+
+        if (!_multiDrawIndirect)
+            std::cerr << "Multi-draw indirect is not supported, using one draw call per node" << std::endl;
+    }
+
+    std::string shaderSuffix = _multiDrawIndirect ? "-mdi" : "";
+
     /* TODO: The below could be improved */
-    _terrainShader = Shader((dataPath + "glsl/terrain.vert").c_str(), (dataPath + "glsl/terrain.frag").c_str());
-    _skirtShader = Shader((dataPath + "glsl/skirt.vert").c_str(), (dataPath + "glsl/skirt.frag").c_str());
+    _terrainShader = Shader((dataPath + "glsl/terrain" + shaderSuffix + ".vert").c_str(), (dataPath + "glsl/terrain" + shaderSuffix + ".frag").c_str());
     _poleShader = Shader((dataPath + "glsl/pole.vert").c_str(), (dataPath + "glsl/pole.frag").c_str());
     _aabbShader = Shader((dataPath + "glsl/aabb.vert").c_str(), (dataPath + "glsl/aabb.frag").c_str());
 
+    _terrainUniforms = NodeUniforms::resolve(_terrainShader);
+
+    if (_tessellationEdgeLength > 0) {
+        _tessellationShader = Shader((dataPath + "glsl/terrain-tess.vert").c_str(), (dataPath + "glsl/terrain-tess.tesc").c_str(),
+            (dataPath + "glsl/terrain-tess.tese").c_str(), (dataPath + "glsl/terrain.frag").c_str());
+        _tessellationUniforms = NodeUniforms::resolve(_tessellationShader);
+        _detailLocation = _tessellationShader.uniformLocation("detail");
+        _tessellationScaleLocation = _tessellationShader.uniformLocation("tessellationScale");
+        _borderCoarserLocation = _tessellationShader.uniformLocation("borderCoarser");
+        _borderMinExponentLocation = _tessellationShader.uniformLocation("borderMinExponent");
+    }
+
+    _pipelineStatistics = GLEW_ARB_pipeline_statistics_query;
+    if (_pipelineStatistics)
+        glGenQueries(INVOCATION_QUERIES, _invocationQueries);
+    _isNorthPoleLocation = _poleShader.uniformLocation("isNorthPole");
+
+    /* The camera and lighting globals are shared by all terrain shaders and
+     * uploaded once per frame, see updateGlobals */
+    glGenBuffers(1, &_globalsBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _globalsBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(GlobalUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, GlobalUniforms::BINDING, _globalsBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    _terrainShader.bindUniformBlock("Globals", GlobalUniforms::BINDING);
+    _poleShader.bindUniformBlock("Globals", GlobalUniforms::BINDING);
+    if (_tessellationEdgeLength > 0)
+        _tessellationShader.bindUniformBlock("Globals", GlobalUniforms::BINDING);
+
     _tileSideLengthLowRes = ConfigManager::getInstance()->lowMeshRes();
     _tileSideLengthMediumRes = ConfigManager::getInstance()->mediumMeshRes();
     _tileSideLengthHighRes = ConfigManager::getInstance()->highMeshRes();
+    _pixelTolerance = ConfigManager::getInstance()->pixelTolerance();
+    _morphRange = ConfigManager::getInstance()->morphRange();
+    _traversalForkDepth = ConfigManager::getInstance()->traversalForkDepth();
+    _skipLevelStride = ConfigManager::getInstance()->skipLevelStride();
+    _integrationBudgetMicros = ConfigManager::getInstance()->integrationBudget();
+
+    if (ConfigManager::getInstance()->traversalThreads() > 0)
+        _traversalPool = new TaskPool(ConfigManager::getInstance()->traversalThreads());
 
     /* Uniforms defined once */
     _terrainShader.use();
@@ -39,12 +97,16 @@ TerrainManager::TerrainManager(RenderStatistics& stats, unsigned lowResMesh, uns
     _terrainShader.setFloat("textureHeight", 512);
     _terrainShader.setVec3("globeRadiusSquared", GlobalConstants::GLOBE_RADII_SQUARED);
 
-    _skirtShader.use();
-    _skirtShader.setInt("overlayTexture", 0);
-    _skirtShader.setInt("heightmapTexture", 1);
-    _skirtShader.setFloat("textureWidth", 512);
-    _skirtShader.setFloat("textureHeight", 512);
-    _skirtShader.setVec3("globeRadiusSquared", GlobalConstants::GLOBE_RADII_SQUARED);
+    if (_tessellationEdgeLength > 0) {
+        GLint maxTessellationLevel = 64;
+        glGetIntegerv(GL_MAX_TESS_GEN_LEVEL, &maxTessellationLevel);
+
+        _tessellationShader.use();
+        _tessellationShader.setInt("overlayTexture", 0);
+        _tessellationShader.setInt("heightmapTexture", 1);
+        _tessellationShader.setVec3("globeRadiusSquared", GlobalConstants::GLOBE_RADII_SQUARED);
+        _tessellationShader.setFloat("maxTessellationLevel", (float)std::min(maxTessellationLevel, 64));
+    }
 
     glm::vec3 circleMeshBorder = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED,
         glm::vec3(0, 0, glm::radians(85.0511f)));
@@ -79,6 +141,18 @@ TerrainManager::TerrainManager(RenderStatistics& stats, unsigned lowResMesh, uns
     Util::checkGlError("SHADER FAILED");
 }
 
+/**
+ * @brief TerrainManager::updateGlobals Uploads the per frame globals of the
+ *        terrain and pole shaders.
+ * @param globals
+ */
+void TerrainManager::updateGlobals(const GlobalUniforms& globals)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, _globalsBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GlobalUniforms), &globals);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 /**
  * @brief TerrainManager::setup
  */
@@ -88,27 +162,31 @@ void TerrainManager::setup()
     _gridMeshLow = new GridMesh(_tileSideLengthLowRes);
     _gridMeshLow->load();
 
-    _skirtMeshLow = new SkirtMesh(_tileSideLengthLowRes);
-    _skirtMeshLow->load();
-
     _gridMeshMedium = new GridMesh(_tileSideLengthMediumRes);
     _gridMeshMedium->load();
 
-    _skirtMeshMedium = new SkirtMesh(_tileSideLengthMediumRes);
-    _skirtMeshMedium->load();
-
     _gridMeshHigh = new GridMesh(_tileSideLengthHighRes);
     _gridMeshHigh->load();
 
-    _skirtMeshHigh = new SkirtMesh(_tileSideLengthHighRes);
-    _skirtMeshHigh->load();
-
     _poleMesh = new PoleMesh(30);
     _poleMesh->load();
 
+    if (_tessellationEdgeLength > 0) {
+        _patchMesh = new PatchMesh();
+        _patchMesh->load();
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+    }
+
     _aabbMesh = new AABBMesh();
     _aabbMesh->load();
 
+    /* A node leases its layer before the evicted node returns its layer */
+    _texturePool = new TexturePool(ConfigManager::getInstance()->memoryCacheSize() + 1);
+    _texturePool->load();
+
+    if (_multiDrawIndirect)
+        setupMultiDrawIndirect();
+
     initDiskCache();
 
     /* Start threads */
@@ -122,6 +200,44 @@ void TerrainManager::setup()
     requestNode(XYZTileKey(0, 0, 0));
 }
 
+/**
+ * @brief TerrainManager::setupMultiDrawIndirect
+ *
+ * Allocates the buffers of the multi-draw indirect path, and adds the draw
+ * ID attribute to the grid meshes.
+ */
+void TerrainManager::setupMultiDrawIndirect()
+{
+    unsigned memoryCacheSize = ConfigManager::getInstance()->memoryCacheSize();
+
+    glGenBuffers(1, &_instanceBuffer);
+    glGenBuffers(1, &_indirectBuffer);
+    glGenBuffers(1, &_drawIdBuffer);
+
+    /* Every resident node results in at most four render items */
+    _drawIdCapacity = 4 * memoryCacheSize;
+    std::vector<GLuint> drawIds(_drawIdCapacity);
+    for (unsigned i = 0; i < _drawIdCapacity; i++)
+        drawIds[i] = i;
+
+    glBindBuffer(GL_ARRAY_BUFFER, _drawIdBuffer);
+    glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+
+    unsigned vaos[3] = { _gridMeshLow->_vao, _gridMeshMedium->_vao, _gridMeshHigh->_vao };
+
+    for (unsigned vao : vaos) {
+        glBindVertexArray(vao);
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    Util::checkGlError("MULTI-DRAW INDIRECT SETUP FAILED");
+}
+
 /**
  * @brief TerrainManager::initTerrainTile
  * @param response
@@ -130,87 +246,256 @@ void TerrainManager::initTerrainNode(LoadResponse response)
 {
     TerrainNode* node = response.node;
 
-    glGenTextures(1, &node->_overlayTextureId);
-    glBindTexture(GL_TEXTURE_2D, node->_overlayTextureId);
+    /* There is always a free layer, since the pool has one layer more than
+     * the memory cache */
+    node->_textureLayer = _texturePool->acquire();
+    int slot = _texturePool->acquireStagingSlot();
 
-    Util::checkGlError("OVERLAY LOAD FAILED");
+    if (!_texturePool->uploadHeightmap(node->_textureLayer, response.heightData, response.heightWidth, response.heightHeight, slot)) {
+        _texturePool->releaseStagingSlot(slot);
+        slot = -1;
+    }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    /* The node is only drawn once the upload has completed, until then its
+     * parent sees it as loading */
+    if (slot >= 0) {
+        node->_heightState = TerrainNode::LOADING_FROM_MEMORY;
+        _pendingUploads.push_back({ node, LOAD_LAYER_HEIGHT, slot });
+    }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    /* There is room, see makeRoomForNode */
+    linkNode(node);
+    _memoryCache.put(node->_xyzTileKey, node);
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, response.overlayWidth, response.overlayHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, response.overlayData);
-    glGenerateMipmap(GL_TEXTURE_2D);
+/**
+ * @brief TerrainManager::makeRoomForNode
+ *
+ * Evicts a node if the memory cache is full. The parent of the new node is
+ * kept, since it is about to get a resident child.
+ *
+ * If a node has children loaded or is the root node, we
+ * do not want to deallocate it and move it to the front instead,
+ * and continue doing the above until finding a deallocatable
+ * node. This policy is mainly intended for small cache sizes.
+ *
+ * This might seem problematic
+ * at first sight, since it
+ * 1. Sort of goes around the LRU policy by moving
+ *    a LRU item to the front.
+ * 2. Risks a long waiting time if many items in the rear
+ *    are candidates for not getting evicted.
+ *
+ * But in practice, if the cache size is large enough,
+ * it is not too problematic. Since we always traverse the tree
+ * top-down, the LRU nodes tend to be leaf nodes, which makes
+ * this occur rarely. Each node is checked at most once, if none can be
+ * evicted (e.g. while all leaves have uploads in flight), the new node has
+ * to wait.
+ *
+ * @param tileKey Of the node to be inserted
+ * @return Whether there is room for the node
+ */
+bool TerrainManager::makeRoomForNode(XYZTileKey tileKey)
+{
+    if (_memoryCache.size() < _memoryCache.capacity())
+        return true;
 
-    Util::checkGlError("OVERLAY LOAD FAILED");
+    auto evicted = _memoryCache.evict([&](XYZTileKey key, TerrainNode* tile) {
+        return checkEviction(key, tile) && (tileKey.z() == 0 || key != tileKey.parent());
+    });
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!evicted)
+        return false;
 
-    glGenTextures(1, &node->_heightmapTextureId);
-    glBindTexture(GL_TEXTURE_2D, node->_heightmapTextureId);
+    XYZTileKey evictedKey = evicted.value().first;
+    TerrainNode* evictedTile = evicted.value().second;
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    unlinkNode(evictedTile);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    /* The overlay will not be requested again for this node */
+    if (evictedTile->_overlayState == TerrainNode::DOWNLOADABLE)
+        discardHeightmap(evictedKey);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, response.heightWidth, response.heightHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, response.heightData);
+    /* Only return the layer, it is overwritten by the next node */
+    _texturePool->release(evictedTile->_textureLayer);
 
-    Util::checkGlError("HEIGHT LOAD FAILED");
+    delete[] evictedTile->_heightData;
+    delete evictedTile;
+    return true;
+}
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+/**
+ * @brief TerrainManager::initOverlay
+ *
+ * Uploads the overlay of a resident node.
+ *
+ * @param node
+ * @param response
+ */
+void TerrainManager::initOverlay(TerrainNode* node, LoadResponse& response)
+{
+    int slot = _texturePool->acquireStagingSlot();
+
+    if (!_texturePool->uploadOverlay(node->_textureLayer, response.overlayData, response.overlayMipmaps, response.overlayWidth, response.overlayHeight, slot)) {
+        _texturePool->releaseStagingSlot(slot);
+        node->_overlayState = TerrainNode::UNDOWNLOADABLE;
+    } else if (slot >= 0) {
+        /* The ancestor's overlay is used until the upload has completed */
+        node->_overlayState = TerrainNode::LOADING_FROM_MEMORY;
+        _pendingUploads.push_back({ node, LOAD_LAYER_OVERLAY, slot });
+    } else {
+        node->_overlayState = TerrainNode::GPU_READY;
+    }
 
-    /* Free overlay main memory, but keep height data for later usage */
+    /* Free overlay main memory */
     stbi_image_free(response.overlayData);
+    delete[] response.overlayMipmaps;
+}
 
-    auto result = _memoryCache.put(node->_xyzTileKey.string(), node);
-    if (result.evicted) {
-        auto evictedKey = result.evictedItem.value().first;
-        auto* evictedTile = result.evictedItem.value().second;
-
-        /* If a node has children loaded or is the root node, we
-         * do not want to deallocate it and insert it back,
-         * and continue doing the above until finding a deallocatable
-         * node. This policy is mainly intended for small cache sizes.
-         *
-         * This might seem problematic
-         * at first sight, since it
-         * 1. Sort of goes around the LRU policy by reinserting
-         *    a LRU item at the front.
-         * 2. Risks a long waiting time if many items in the rear
-         *    are candidates for not getting evicted.
-         *
-         * But in practice, if the cache size is large enough,
-         * it is not too problematic. Since we always traverse the tree
-         * top-down, the LRU nodes tend to be leaf nodes, which makes
-         * this while loop occur rarely.
-         */
-        while (!checkEviction(evictedKey, evictedTile)) {
-            result = _memoryCache.put(evictedKey, evictedTile);
-            evictedKey = result.evictedItem.value().first;
-            evictedTile = result.evictedItem.value().second;
-        }
+/**
+ * @brief TerrainManager::indexDiskCache
+ *
+ * Adds a tile to the disk cache index once both of its layers are on disk,
+ * whether or not its node is still resident.
+ *
+ * The files are already written, so if no tile can be evicted, the index
+ * temporarily grows beyond the disk cache size. Later insertions evict
+ * until it is back within the size.
+ *
+ * @param tileKey
+ */
+void TerrainManager::indexDiskCache(XYZTileKey tileKey)
+{
+    /* Do the same as for the memory cache but for disk eviction */
+    while (!_diskCache.contains(tileKey) && _diskCache.size() >= _diskCache.capacity()) {
+        auto evicted = _diskCache.evict([&](XYZTileKey key, void*) {
+            return checkEviction(key, nullptr) && !_loadingTiles.count(key);
+        });
+
+        if (!evicted)
+            break;
+
+        XYZTileKey evictedKey = evicted.value().first;
+        _currentDiskCacheEvictions.insert(evictedKey);
+        _unloadRequestQueue->push({ evictedKey, UNLOAD_REQUEST });
+    }
+
+    _diskCache.put(tileKey, nullptr, false);
+}
+
+/**
+ * @brief TerrainManager::discardHeightmap
+ *
+ * Heightmaps downloaded from the API are persisted before their overlay
+ * arrives. If the overlay never does, the tile is not indexed and the
+ * heightmap would stay on disk until the next start up, so it is removed
+ * by the disk deallocation worker. The tile is not requested again until
+ * the file is gone.
+ *
+ * @param tileKey
+ */
+void TerrainManager::discardHeightmap(XYZTileKey tileKey)
+{
+    if (_diskCache.contains(tileKey) || _currentDiskCacheEvictions.count(tileKey))
+        return;
+
+    _currentDiskCacheEvictions.insert(tileKey);
+    _unloadRequestQueue->push({ tileKey, UNLOAD_REQUEST });
+}
 
-        glDeleteTextures(1, &evictedTile->_heightmapTextureId);
-        glDeleteTextures(1, &evictedTile->_overlayTextureId);
+/**
+ * @brief TerrainManager::linkNode
+ *
+ * Links a newly loaded node with its parent and children, if they are
+ * resident. Children may be resident without their parent, if the parent
+ * got evicted while they were being loaded.
+ *
+ * @param node
+ */
+void TerrainManager::linkNode(TerrainNode* node)
+{
+    XYZTileKey tileKey = node->_xyzTileKey;
 
-        delete[] evictedTile->_heightData;
-        delete evictedTile;
+    if (tileKey.z() == 0) {
+        _root = node;
+        invalidateCut(node);
+    } else {
+        auto parent = _memoryCache.peek(tileKey.parent());
+        if (parent) {
+            node->_parent = parent.value();
+            node->_parent->_children[tileKey.quadrant()] = node;
+            node->_parent->_childStates[tileKey.quadrant()] = node->_heightState == TerrainNode::GPU_READY
+                ? TerrainNode::CHILD_RESIDENT
+                : TerrainNode::CHILD_LOADING;
+            node->_parent->_childBounds.set(tileKey.quadrant(), node->_aabbP1, node->_aabbP2);
+            node->_parent->_cullMemoGeneration = 0;
+            invalidateCut(node->_parent);
+        }
     }
 
-    /* Do the same as above but for disk eviction */
-    auto diskResult = _diskCache.put(node->_xyzTileKey.string(), nullptr);
-    if (diskResult.evicted) {
-        auto evictedKey = diskResult.evictedItem.value().first;
-        while (!checkEviction(evictedKey, nullptr) || _loadingTiles.count(evictedKey)) {
-            diskResult = _diskCache.put(evictedKey, nullptr);
-            evictedKey = diskResult.evictedItem.value().first;
+    for (unsigned q = 0; q < 4; q++) {
+        XYZTileKey childKey = tileKey.child(q);
+        auto child = _memoryCache.peek(childKey);
+
+        if (child) {
+            child.value()->_parent = node;
+            node->_children[q] = child.value();
+            node->_childStates[q] = child.value()->_heightState == TerrainNode::GPU_READY
+                ? TerrainNode::CHILD_RESIDENT
+                : TerrainNode::CHILD_LOADING;
+            node->_childBounds.set(q, child.value()->_aabbP1, child.value()->_aabbP2);
+        } else if (_loadingTiles.count(childKey)) {
+            node->_childStates[q] = TerrainNode::CHILD_LOADING;
+        } else if (_unloadableTileKeys.count(childKey)) {
+            node->_childStates[q] = TerrainNode::CHILD_UNLOADABLE;
         }
-        _currentDiskCacheEvictions.insert(evictedKey);
-        _unloadRequestQueue->push({ evictedKey, UNLOAD_REQUEST });
+    }
+}
+
+/**
+ * @brief TerrainManager::unlinkNode
+ *
+ * Removes an evicted node from the quadtree. Evicted nodes never have
+ * resident children, see checkEviction.
+ *
+ * @param node
+ */
+void TerrainManager::unlinkNode(TerrainNode* node)
+{
+    if (node->_parent) {
+        unsigned q = node->_xyzTileKey.quadrant();
+        node->_parent->_children[q] = nullptr;
+        node->_parent->_childStates[q] = TerrainNode::CHILD_ABSENT;
+
+        /* Fall back to the predicted bounds */
+        const TerrainNode::ChildPrediction& prediction = node->_parent->_childPredictions[q];
+        node->_parent->_childBounds.set(q, prediction.aabbP1, prediction.aabbP2);
+        node->_parent->_cullMemoGeneration = 0;
+        invalidateCut(node->_parent);
+
+        node->_parent = nullptr;
+    }
+}
+
+/**
+ * @brief TerrainManager::setChildState
+ *
+ * Updates the child state of the parent of a non resident tile, if the
+ * parent is resident.
+ *
+ * @param tileKey
+ * @param state
+ */
+void TerrainManager::setChildState(XYZTileKey tileKey, TerrainNode::ChildState state)
+{
+    if (tileKey.z() == 0)
+        return;
+
+    auto parent = _memoryCache.peek(tileKey.parent());
+    if (parent) {
+        parent.value()->_childStates[tileKey.quadrant()] = state;
+        invalidateCut(parent.value());
     }
 }
 
@@ -218,183 +503,660 @@ void TerrainManager::initTerrainNode(LoadResponse response)
  * TODO: Create checkDiskEviction and checkMemoryEviction?
  *
  * @brief TerrainManager::checkEviction
+ *
+ * For memory cache entries the quadtree links are used, disk cache entries
+ * (tile is nullptr) are checked by key.
+ *
  * @param tileKey
  * @param tile
  * @return
  */
 bool TerrainManager::checkEviction(XYZTileKey tileKey, TerrainNode* tile)
 {
+    /* Nodes with uploads in flight are referenced by _pendingUploads */
+    if (tile != nullptr)
+        return tile != _root && !tile->hasResidentChildren()
+            && tile->_heightState != TerrainNode::LOADING_FROM_MEMORY
+            && tile->_overlayState != TerrainNode::LOADING_FROM_MEMORY;
+
     return !hasChildren(tileKey) && tileKey != XYZTileKey(0, 0, 0);
 }
 
+/**
+ * @brief TerrainManager::traverse
+ *
+ * Collects the visible nodes into _visibleNodes. If the parallel traversal
+ * is enabled, the subtrees at the fork depth are traversed as tasks on the
+ * traversal pool, and the results are merged in the order of the serial
+ * traversal afterwards.
+ *
+ * The contexts of the last traversal are kept, since subtrees whose output
+ * cannot have changed copy it from there.
+ *
+ * @param camera
+ */
+void TerrainManager::traverse(Camera& camera)
+{
+    std::swap(_traversal, _previousTraversal);
+    std::swap(_forkContexts, _previousForkContexts);
+    _traversalCount++;
+
+    _traversal.clear();
+    _traversal.forkDepth = _traversalPool ? _traversalForkDepth : TraversalContext::NO_FORK;
+
+    glm::vec2 cameraLonLat = MapProjections::toGeodetic2D(camera.position(), GlobalConstants::GLOBE_RADII_SQUARED);
+    _cameraPosition = camera.position();
+    _cameraMercator = MapProjections::webMercator(cameraLonLat);
+
+    collectRenderable(camera, _root, true, FrustumCulling::ALL_PLANES, _traversal);
+
+    unsigned numForks = _traversal.forks.size();
+    if (_forkContexts.size() < numForks)
+        _forkContexts.resize(numForks);
+
+    for (unsigned i = 0; i < numForks; i++) {
+        _forkContexts[i].clear();
+        _forkContexts[i].index = i + 1;
+    }
+
+    if (numForks > 0) {
+        _traversalPool->run(numForks, [&](unsigned i) {
+            const TraversalFork& fork = _traversal.forks[i];
+            collectRenderable(camera, fork.node, fork.insideFrustum, fork.planeMask, _forkContexts[i]);
+        });
+    }
+
+    _stats.traversalTasks = numForks;
+    mergeTraversal();
+}
+
 /**
  * @brief TerrainManager::collectRenderable
+ *
+ * Safe to run concurrently on disjoint subtrees, but not on overlapping
+ * ones: besides reading shared state, it writes the memoized decisions and
+ * the timestamp of every node it visits, which only the task owning the
+ * subtree does. Everything else it produces goes into the context.
+ *
  * @param camera
- * @param currentTileKey
- * @param visibleTiles
+ * @param currentNode
+ * @param insideFrustum
+ * @param planeMask
+ * @param context
  */
-void TerrainManager::collectRenderable(Camera& camera, XYZTileKey currentTileKey, std::queue<std::string>& visibleTiles, XYZTileKey& minimumDistanceTileKey, float& minimumDistance)
+CutMargin TerrainManager::collectRenderable(Camera& camera, TerrainNode* currentNode, bool insideFrustum, unsigned planeMask, TraversalContext& context)
 {
-    /* Put current tile to front of disk cache */
-    _diskCache.get(currentTileKey.string());
+    unsigned level = currentNode->_xyzTileKey.z();
+
+    /* Leave visible subtrees at the fork depth to a task. Their margin is
+     * not known yet, so the nodes above the forks are evaluated every
+     * time. */
+    if (insideFrustum && level == context.forkDepth) {
+        context.forks.push_back({ currentNode, insideFrustum, planeMask,
+            context.visibleNodes.size(), context.childRequests.size(), context.skipLevelRequests.size(),
+            context.overlayRequests.size(), context.touchedKeys.size() });
+        return { 0.0f, 0.0f };
+    }
 
-    TerrainNode* currentNode = _memoryCache.get(currentTileKey.string()).value();
-    currentNode->_lastUsedTimeStamp = std::chrono::system_clock::now();
+    CutMargin margin;
+    if (reuseSubtree(camera, currentNode, insideFrustum, planeMask, context, margin))
+        return margin;
+
+    std::size_t visibleBegin = context.visibleNodes.size();
+    std::size_t touchBegin = context.touchedKeys.size();
+
+    margin = evaluateNode(camera, currentNode, insideFrustum, planeMask, context);
+
+    currentNode->_cutMemoTraversal = _traversalCount;
+    currentNode->_cutMemoGeneration = _lodGeneration;
+    currentNode->_cutMemoContext = context.index;
+    currentNode->_cutMemoInsideFrustum = insideFrustum;
+    currentNode->_cutMemoPlaneMask = planeMask;
+    currentNode->_cutMemoVisibleBegin = visibleBegin;
+    currentNode->_cutMemoVisibleEnd = context.visibleNodes.size();
+    currentNode->_cutMemoTouchBegin = touchBegin;
+    currentNode->_cutMemoTouchEnd = context.touchedKeys.size();
+    currentNode->_cutMemoMargin = margin.margin;
+    currentNode->_cutMemoReach = margin.reach;
+    currentNode->_cutMemoPosition = camera.position();
+    currentNode->_cutMemoFront = camera.front();
+    currentNode->_cutMemoUp = camera.up();
+
+    return margin;
+}
+
+/**
+ * @brief TerrainManager::reuseSubtree
+ *
+ * Copies the output of the last traversal of a subtree, if it cannot have
+ * changed: the node was traversed by the last traversal with the same
+ * frustum state, nothing was loaded or evicted below it since (see
+ * invalidateCut), and the camera moved less than the margin.
+ *
+ * @param camera
+ * @param node
+ * @param insideFrustum
+ * @param planeMask
+ * @param context
+ * @param margin Set to the remaining margin if the subtree is reused
+ * @return Whether the subtree was reused
+ */
+bool TerrainManager::reuseSubtree(Camera& camera, TerrainNode* node, bool insideFrustum, unsigned planeMask, TraversalContext& context, CutMargin& margin)
+{
+    if (node->_cutMemoTraversal != _traversalCount - 1
+        || node->_cutMemoGeneration != _lodGeneration
+        || node->_cutMemoInsideFrustum != insideFrustum
+        || node->_cutMemoPlaneMask != planeMask)
+        return false;
+
+    float motion = cameraMotion(camera, node->_cutMemoPosition, node->_cutMemoFront, node->_cutMemoUp, node->_cutMemoReach);
+    if (motion >= node->_cutMemoMargin)
+        return false;
+
+    const TraversalContext& previous = node->_cutMemoContext == 0 ? _previousTraversal : _previousForkContexts[node->_cutMemoContext - 1];
+    std::size_t visibleBegin = context.visibleNodes.size();
+    std::size_t touchBegin = context.touchedKeys.size();
+
+    context.visibleNodes.insert(context.visibleNodes.end(),
+        previous.visibleNodes.begin() + node->_cutMemoVisibleBegin, previous.visibleNodes.begin() + node->_cutMemoVisibleEnd);
+    context.touchedKeys.insert(context.touchedKeys.end(),
+        previous.touchedKeys.begin() + node->_cutMemoTouchBegin, previous.touchedKeys.begin() + node->_cutMemoTouchEnd);
+    context.reusedSubtrees++;
+
+    /* The margin stays relative to where the subtree was evaluated */
+    node->_cutMemoTraversal = _traversalCount;
+    node->_cutMemoContext = context.index;
+    node->_cutMemoVisibleBegin = visibleBegin;
+    node->_cutMemoVisibleEnd = context.visibleNodes.size();
+    node->_cutMemoTouchBegin = touchBegin;
+    node->_cutMemoTouchEnd = context.touchedKeys.size();
+
+    margin = { node->_cutMemoMargin - motion, node->_cutMemoReach };
+    return true;
+}
+
+/**
+ * @brief TerrainManager::invalidateCut Prevents reusing the traversal
+ *        output of the subtrees containing a node, after the node or its
+ *        children changed. The next frame traverses the tree again.
+ * @param node
+ */
+void TerrainManager::invalidateCut(TerrainNode* node)
+{
+    for (; node != nullptr; node = node->_parent)
+        node->_cutMemoTraversal = 0;
+
+    _treeVersion++;
+}
 
+/**
+ * @brief TerrainManager::evaluateNode
+ *
+ * Decides whether a node is drawn, split or culled, and traverses its
+ * children.
+ *
+ * The returned margin is the smallest margin of all decisions in the
+ * subtree, so the output of the subtree stays the same while the camera
+ * moves less. Nodes which request tiles, or which are horizon culled, get
+ * no margin: the requests have to be repeated until the tiles arrive, and
+ * horizon culling is not memoized.
+ *
+ * @param camera
+ * @param currentNode
+ * @param insideFrustum
+ * @param planeMask
+ * @param context
+ * @return
+ */
+CutMargin TerrainManager::evaluateNode(Camera& camera, TerrainNode* currentNode, bool insideFrustum, unsigned planeMask, TraversalContext& context)
+{
+    XYZTileKey currentTileKey = currentNode->_xyzTileKey;
     unsigned level = currentTileKey.z();
 
-    bool visible = true;
+    /* Put current tile to front of memory and disk cache, once the
+     * traversal is done */
+    context.touchedKeys.push_back(currentTileKey);
 
-    if (level <= 2)
-        visible = true;
-    else
-        visible = camera.insideViewFrustum(currentNode->_aabbP1, currentNode->_aabbP2);
+    currentNode->_lastUsedTimeStamp = std::chrono::system_clock::now();
 
-    /* We do horizon culling only from level 2 upwards */
-    if (level >= 3)
-        visible = visible && !currentNode->horizonCulled(camera);
+    /* Frustum culling was already done by the parent for all four children
+     * at once, and is covered by the parent's margin. We do horizon culling
+     * only from level 2 upwards */
+    if (!insideFrustum)
+        return { std::numeric_limits<float>::max(), 0.0f };
 
-    if (!visible)
-        return;
+    if (level >= 3 && currentNode->horizonCulled(*_horizonCullingCamera))
+        return { 0.0f, 0.0f };
+
+    context.traversedNodes++;
 
-    _stats.traversedNodes++;
+    unsigned maxZoom = ConfigManager::getInstance()->maxZoom();
+    bool split = shouldSplit(camera, currentNode, context) && level < maxZoom;
 
-    bool split = shouldSplit(camera, currentTileKey) && level < ConfigManager::getInstance()->maxZoom();
+    CutMargin margin = { currentNode->_splitMemoMargin - glm::length(camera.position() - currentNode->_splitMemoPosition), 0.0f };
+
+    if (currentNode->_overlayState == TerrainNode::DOWNLOADABLE) {
+        context.overlayRequests.push_back(currentNode);
+        margin.margin = 0.0f;
+    }
 
     if (!split) {
-        updateMinimumDistanceTileKey(camera, currentTileKey, minimumDistanceTileKey, minimumDistance);
-        visibleTiles.push(currentTileKey.string());
-    } else {
-        if (!allChildrenExistant(currentTileKey)) {
-            visibleTiles.push(currentTileKey.string());
-            updateMinimumDistanceTileKey(camera, currentTileKey, minimumDistanceTileKey, minimumDistance);
+        context.visibleNodes.push_back({ currentNode, RenderItem::WHOLE_NODE });
+        return margin;
+    }
+
+    /* Cull the four children at once, up to level 2 everything is
+     * considered visible. Non resident children are culled with the bounds
+     * predicted from this node. Only the planes this node is not fully
+     * inside of are tested, if there are none the whole subtree is
+     * visible. */
+    unsigned visibleChildren = 0xF;
+    unsigned childPlaneMasks[4] = { planeMask, planeMask, planeMask, planeMask };
+
+    if (level + 1 >= 3 && planeMask != 0) {
+        visibleChildren = cullChildren(camera, currentNode, planeMask, childPlaneMasks, context);
+
+        float motion = cameraMotion(camera, currentNode->_cullMemoPosition, currentNode->_cullMemoFront, currentNode->_cullMemoUp, currentNode->_cullMemoReach);
+        margin.margin = std::min(margin.margin, currentNode->_cullMemoSlack - motion);
+        margin.reach = currentNode->_cullMemoReach;
+    } else if (level + 1 >= 3) {
+        context.planeTestsSaved += 4 * FrustumCulling::NUM_PLANES;
+    }
+
+    /* Children which are visible but not resident yet */
+    unsigned missingChildren = 0;
+
+    for (unsigned q = 0; q < 4; q++) {
+        if (currentNode->_childStates[q] == TerrainNode::CHILD_RESIDENT)
+            continue;
+
+        bool horizonCulled = (visibleChildren & (1u << q))
+            && level + 1 >= 3 && currentNode->childHorizonCulled(q, *_horizonCullingCamera);
 
-            /* Post nodes to request queue if they do not exist or are not
-             * being loaded yet */
-            requestChildren(currentTileKey);
+        if ((visibleChildren & (1u << q)) && !horizonCulled) {
+            missingChildren |= 1u << q;
 
+            if (currentNode->_childStates[q] != TerrainNode::CHILD_UNLOADABLE)
+                margin.margin = 0.0f;
         } else {
-            /* Traverse four children (only if they are loaded) */
-            collectRenderable(camera, currentTileKey.topLeftChild(), visibleTiles, minimumDistanceTileKey, minimumDistance);
-            collectRenderable(camera, currentTileKey.topRightChild(), visibleTiles, minimumDistanceTileKey, minimumDistance);
-            collectRenderable(camera, currentTileKey.bottomLeftChild(), visibleTiles, minimumDistanceTileKey, minimumDistance);
-            collectRenderable(camera, currentTileKey.bottomRightChild(), visibleTiles, minimumDistanceTileKey, minimumDistance);
+            context.culledChildren++;
+
+            if (horizonCulled)
+                margin.margin = 0.0f;
+        }
+    }
+
+    if (missingChildren) {
+        /* Post visible nodes to request queue if they do not exist or are
+         * not being loaded yet */
+        context.childRequests.push_back({ currentNode, missingChildren });
+
+        if (_skipLevelStride > 0)
+            collectSkipLevelRequests(camera, currentNode, context);
+
+        /* Nothing to refine yet, so draw the node in one piece */
+        if (!currentNode->hasResidentChildren()) {
+            context.visibleNodes.push_back({ currentNode, RenderItem::WHOLE_NODE });
+            return margin;
         }
     }
+
+    /* Traverse the resident children and draw the missing ones from this
+     * node's data, so that detail increases per quadrant as children
+     * arrive. Culled children are still visited to keep them in the
+     * caches */
+    for (unsigned q = 0; q < 4; q++) {
+        if (currentNode->_childStates[q] == TerrainNode::CHILD_RESIDENT) {
+            CutMargin childMargin = collectRenderable(camera, currentNode->_children[q], visibleChildren & (1u << q), childPlaneMasks[q], context);
+            margin.margin = std::min(margin.margin, childMargin.margin);
+            margin.reach = std::max(margin.reach, childMargin.reach);
+        } else if (missingChildren & (1u << q)) {
+            context.visibleNodes.push_back({ currentNode, (unsigned char)q });
+        }
+    }
+
+    return margin;
 }
 
+namespace {
+
 /**
- * @brief TerrainManager::updateMinimumDistanceTileKey
- * @param camera
- * @param currentTileKey
- * @param minimumDistanceTileKey
- * @param minimumDistance
+ * @brief spliceForks Concatenates the results of the forking traversal and
+ *                    of its forks in the order of the serial traversal.
+ */
+template <typename T, typename Member, typename Offset>
+void spliceForks(std::vector<T>& result, const TraversalContext& traversal, const std::vector<TraversalContext>& forkContexts, Member member, Offset offset)
+{
+    const std::vector<T>& own = traversal.*member;
+    result.clear();
+
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < traversal.forks.size(); i++) {
+        std::size_t end = traversal.forks[i].*offset;
+        result.insert(result.end(), own.begin() + begin, own.begin() + end);
+
+        const std::vector<T>& forked = forkContexts[i].*member;
+        result.insert(result.end(), forked.begin(), forked.end());
+        begin = end;
+    }
+
+    result.insert(result.end(), own.begin() + begin, own.end());
+}
+
+}
+
+/**
+ * @brief TerrainManager::mergeTraversal
+ *
+ * Merges the results of the traversal tasks and applies the deferred cache
+ * touches and requests on the render thread. The order is the same as if
+ * the tree had been traversed serially, so the caches end up the same.
  */
-void TerrainManager::updateMinimumDistanceTileKey(Camera& camera, XYZTileKey currentTileKey, XYZTileKey& minimumDistanceTileKey, float& minimumDistance)
+void TerrainManager::mergeTraversal()
 {
+    const std::vector<TraversalContext>& forks = _forkContexts;
+    unsigned numForks = _traversal.forks.size();
+
+    spliceForks(_visibleNodes, _traversal, forks, &TraversalContext::visibleNodes, &TraversalFork::visibleOffset);
+
+    /* The touches and requests of the root context can be merged in place
+     * since they are not needed afterwards */
+    std::vector<XYZTileKey> touchedKeys;
+    std::vector<ChildRequest> childRequests;
+    std::vector<XYZTileKey> skipLevelRequests;
+    std::vector<TerrainNode*> overlayRequests;
+    const std::vector<XYZTileKey>* touches = &_traversal.touchedKeys;
+    const std::vector<ChildRequest>* requests = &_traversal.childRequests;
+    const std::vector<XYZTileKey>* skipLevel = &_traversal.skipLevelRequests;
+    const std::vector<TerrainNode*>* overlays = &_traversal.overlayRequests;
+
+    if (numForks > 0) {
+        spliceForks(touchedKeys, _traversal, forks, &TraversalContext::touchedKeys, &TraversalFork::touchOffset);
+        spliceForks(childRequests, _traversal, forks, &TraversalContext::childRequests, &TraversalFork::requestOffset);
+        spliceForks(skipLevelRequests, _traversal, forks, &TraversalContext::skipLevelRequests, &TraversalFork::skipLevelOffset);
+        spliceForks(overlayRequests, _traversal, forks, &TraversalContext::overlayRequests, &TraversalFork::overlayOffset);
+        touches = &touchedKeys;
+        requests = &childRequests;
+        skipLevel = &skipLevelRequests;
+        overlays = &overlayRequests;
+    }
+
+    for (const XYZTileKey& key : *touches) {
+        _memoryCache.touch(key);
+        _diskCache.touch(key);
+    }
+
+    for (const ChildRequest& request : *requests)
+        requestChildren(request.node, request.quadrants);
+
+    for (TerrainNode* node : *overlays)
+        requestOverlay(node);
 
+    /* The children are requested first, since they are needed first */
+    for (const XYZTileKey& tileKey : *skipLevel) {
+        if (requestNode(tileKey)) {
+            setChildState(tileKey, TerrainNode::CHILD_LOADING);
+            _stats.skipLevelRequests++;
+        }
+    }
+
+    _stats.traversedNodes += _traversal.traversedNodes;
+    _stats.reusedSubtrees += _traversal.reusedSubtrees;
+    _stats.planeTestsSaved += _traversal.planeTestsSaved;
+    _stats.memoizedDecisions += _traversal.memoizedDecisions;
+    _stats.culledChildren += _traversal.culledChildren;
+
+    for (unsigned i = 0; i < numForks; i++) {
+        _stats.traversedNodes += forks[i].traversedNodes;
+        _stats.reusedSubtrees += forks[i].reusedSubtrees;
+        _stats.planeTestsSaved += forks[i].planeTestsSaved;
+        _stats.memoizedDecisions += forks[i].memoizedDecisions;
+        _stats.culledChildren += forks[i].culledChildren;
+    }
+}
+
+/**
+ * @brief TerrainManager::findMinimumDistanceTileKey
+ * @param camera
+ * @return The last visible node in traversal order which lies below the
+ *         camera, or the root key if there is none
+ */
+XYZTileKey TerrainManager::findMinimumDistanceTileKey(Camera& camera)
+{
     glm::vec2 cameraLonLat = MapProjections::toGeodetic2D(camera.position(), GlobalConstants::GLOBE_RADII_SQUARED);
     glm::vec2 cameraMerc = MapProjections::webMercator(cameraLonLat);
 
-    float pow2Zoom = (float)(1 << currentTileKey.z());
-    float minLon = (currentTileKey.x()) / pow2Zoom;
-    float maxLon = (currentTileKey.x() + 1) / pow2Zoom;
-    float minLat = (currentTileKey.y()) / pow2Zoom;
-    float maxLat = (currentTileKey.y() + 1) / pow2Zoom;
+    for (auto it = _visibleNodes.rbegin(); it != _visibleNodes.rend(); ++it) {
+        /* Quadrants are tested with the bounds of the missing child, but the
+         * key of the resident node is returned */
+        XYZTileKey nodeTileKey = it->node->_xyzTileKey;
+        XYZTileKey currentTileKey = it->quadrant == RenderItem::WHOLE_NODE ? nodeTileKey : nodeTileKey.child(it->quadrant);
 
-    if (cameraMerc.x >= minLon && cameraMerc.x <= maxLon && cameraMerc.y >= minLat && cameraMerc.y <= maxLat) {
-        minimumDistanceTileKey = currentTileKey;
+        float pow2Zoom = (float)(1 << currentTileKey.z());
+        float minLon = (currentTileKey.x()) / pow2Zoom;
+        float maxLon = (currentTileKey.x() + 1) / pow2Zoom;
+        float minLat = (currentTileKey.y()) / pow2Zoom;
+        float maxLat = (currentTileKey.y() + 1) / pow2Zoom;
+
+        if (cameraMerc.x >= minLon && cameraMerc.x <= maxLon && cameraMerc.y >= minLat && cameraMerc.y <= maxLat)
+            return nodeTileKey;
     }
+
+    return XYZTileKey(0, 0, 0);
 }
 
 /**
  * @brief TerrainManager::requestChildren
- * @param tileKey
+ * @param node
+ * @param quadrants Bit mask of the children to request
+ */
+void TerrainManager::requestChildren(TerrainNode* node, unsigned quadrants)
+{
+    for (unsigned q = 0; q < 4; q++) {
+        if ((quadrants & (1u << q)) && node->_childStates[q] == TerrainNode::CHILD_ABSENT && requestNode(node->_xyzTileKey.child(q)))
+            node->_childStates[q] = TerrainNode::CHILD_LOADING;
+    }
+}
+
+/**
+ * @brief TerrainManager::collectSkipLevelRequests
+ *
+ * Skip-level loading: instead of waiting for each level to arrive before
+ * requesting the next one, estimate the level needed below the camera and
+ * request the tiles towards it at once. The geometric error roughly halves
+ * with each level, so k levels below the node are needed for
+ * error * K / (2^k * distance) <= tolerance. The distance is taken from the
+ * node's bounds, but at least the camera altitude above the node.
+ *
+ * Only every n-th level (the stride) on the chain of tiles closest to the
+ * camera is requested, each with its siblings, so that the parent can split
+ * as soon as it arrives. The nodes in between are loaded as usual. Until
+ * then, the nearest loaded ancestor is rendered.
+ *
+ * @param camera
+ * @param node Node that splits but has missing children
+ * @param context
  */
-void TerrainManager::requestChildren(XYZTileKey tileKey)
+void TerrainManager::collectSkipLevelRequests(Camera& camera, TerrainNode* node, TraversalContext& context)
 {
-    requestNode(tileKey.topLeftChild());
-    requestNode(tileKey.topRightChild());
-    requestNode(tileKey.bottomLeftChild());
-    requestNode(tileKey.bottomRightChild());
+    unsigned level = node->_xyzTileKey.z();
+    unsigned maxZoom = ConfigManager::getInstance()->maxZoom();
+
+    glm::vec3 cameraPos = camera.position();
+    glm::vec3 outside = glm::max(glm::max(node->_aabbP1 - cameraPos, cameraPos - node->_aabbP2), glm::vec3(0.0f));
+    float altitude = glm::length(cameraPos) - GlobalConstants::GLOBE_RADII.x - node->_maxHeight;
+    float distance = std::max(std::max(glm::length(outside), altitude), 0.0001f);
+
+    float ratio = node->_geometricError * _screenSpaceErrorFactor / (distance * _pixelTolerance);
+    if (ratio <= 2.0f)
+        return;
+
+    unsigned targetLevel = std::min(level + (unsigned)std::ceil(std::log2(ratio)), maxZoom);
+
+    /* Point of the node closest to the camera, in web mercator */
+    float pow2Level = (float)(1 << level);
+    float inset = 0.001f / pow2Level;
+    glm::vec2 tileMin = glm::vec2(node->_xyzTileKey.x(), node->_xyzTileKey.y()) / pow2Level + inset;
+    glm::vec2 tileMax = glm::vec2(node->_xyzTileKey.x() + 1, node->_xyzTileKey.y() + 1) / pow2Level - inset;
+    glm::vec2 point = glm::max(glm::min(_cameraMercator, tileMax), tileMin);
+
+    /* The children of the node are requested anyway. The target level is
+     * always part of the chain, even if the stride does not hit it. */
+    for (unsigned m = level + 1 + _skipLevelStride; m < targetLevel + _skipLevelStride; m += _skipLevelStride) {
+        unsigned zoom = std::min(m, targetLevel);
+        float pow2Zoom = (float)(1 << zoom);
+        XYZTileKey tileKey((unsigned)(point.x * pow2Zoom), (unsigned)(point.y * pow2Zoom), zoom);
+        XYZTileKey parentKey = tileKey.parent();
+
+        for (unsigned q = 0; q < 4; q++)
+            context.skipLevelRequests.push_back(parentKey.child(q));
+    }
 }
 
 /**
  * @brief TerrainManager::requestTile
  * @param tileKey
+ * @return Whether a load request was posted
  */
-void TerrainManager::requestNode(XYZTileKey tileKey)
+bool TerrainManager::requestNode(XYZTileKey tileKey)
 {
     if (!_memoryCache.contains(tileKey)
         && !_loadingTiles.count(tileKey)
         && !_unloadableTileKeys.count(tileKey)
         && !_currentDiskCacheEvictions.count(tileKey)) {
-        _loadingTiles.insert(tileKey.string());
+        _loadingTiles.insert(tileKey);
 
         LoadRequestType requestType = _diskCache.contains(tileKey) ? LOAD_REQUEST_DISK_CACHE : LOAD_REQUEST;
         bool offlineMode = _offlineWait;
-        _loadRequestQueues[_currentLoadThread]->push({ tileKey, requestType, offlineMode });
+        _loadRequestQueues[_currentLoadThread]->push({ tileKey, requestType, offlineMode, requestPriority(tileKey) });
 
         _currentLoadThread = (_currentLoadThread + 1) % _numLoadWorkers;
         _numberOfRequestedTiles++;
+        return true;
     }
+    return false;
 }
 
 /**
- * @brief TerrainManager::allChildrenExistant
- * @param tileKey
+ * @brief TerrainManager::shouldSplit
+ *
+ * Splits a node if its geometric error, projected to the screen at the
+ * distance of its bounding box, exceeds the pixel tolerance.
+ *
+ * @param camera
+ * @param tile
  * @return
  */
-bool TerrainManager::allChildrenExistant(XYZTileKey tileKey)
+bool TerrainManager::shouldSplit(Camera& camera, TerrainNode* tile, TraversalContext& context)
 {
-    return _memoryCache.contains(tileKey.topLeftChild())
-        && _memoryCache.contains(tileKey.topRightChild())
-        && _memoryCache.contains(tileKey.bottomLeftChild())
-        && _memoryCache.contains(tileKey.bottomRightChild());
+    glm::vec3 cameraPos = camera.position();
+
+    /* The distance to a box changes at most as much as the camera moves, so
+     * the last decision holds while the camera stays within the margin */
+    if (tile->_splitMemoGeneration == _lodGeneration
+        && glm::length(cameraPos - tile->_splitMemoPosition) < tile->_splitMemoMargin) {
+        context.memoizedDecisions++;
+        return tile->_splitMemo;
+    }
+
+    glm::vec3 outside = glm::max(glm::max(tile->_aabbP1 - cameraPos, cameraPos - tile->_aabbP2), glm::vec3(0.0f));
+    float distance = glm::length(outside);
+
+    /* The error exceeds the tolerance closer than this distance */
+    float splitDistance = tile->_geometricError * _screenSpaceErrorFactor / _pixelTolerance;
+
+    /* Camera is inside the bounding box */
+    bool split = distance <= 0.0f || distance < splitDistance;
+
+    tile->_splitMemoGeneration = _lodGeneration;
+    tile->_splitMemo = split;
+    tile->_splitMemoMargin = std::abs(distance - splitDistance);
+    tile->_splitMemoPosition = cameraPos;
+
+    return split;
 }
 
 /**
- * @brief TerrainManager::shouldSplit
+ * @brief TerrainManager::cullChildren
+ *
+ * Frustum culls the four children of a node at once. The result is
+ * memoized and reused while the planes cannot have moved across any of the
+ * children's boxes: a box point at distance D from the camera moves
+ * relative to a plane by at most the camera translation plus D times the
+ * change of the plane normal, which is bounded by 4 * (|df| + |du|) for
+ * the front and up vectors.
+ *
  * @param camera
- * @param currentTileKey
- * @return
+ * @param node
+ * @param planeMask
+ * @param childPlaneMasks
+ * @return Bit mask of the visible children
  */
-bool TerrainManager::shouldSplit(Camera& camera, XYZTileKey currentTileKey)
+unsigned TerrainManager::cullChildren(Camera& camera, TerrainNode* node, unsigned planeMask, unsigned childPlaneMasks[4], TraversalContext& context)
 {
-    float pow2Level = (float)(1 << currentTileKey.z());
-    TerrainNode* tile = _memoryCache.get(currentTileKey).value();
+    glm::vec3 position = camera.position();
+    glm::vec3 front = camera.front();
+    glm::vec3 up = camera.up();
 
-    /* Iterate through grid points, check distance */
-    for (auto p : tile->_projectedGridPoints) {
-        glm::vec3 tempVec = p - camera.position();
-        float distSquared = glm::dot(tempVec, tempVec);
+    if (node->_cullMemoGeneration == _lodGeneration && node->_cullMemoPlaneMask == planeMask) {
+        float motion = cameraMotion(camera, node->_cullMemoPosition, node->_cullMemoFront, node->_cullMemoUp, node->_cullMemoReach);
 
-        float baseDist = computeBaseDistWithLatitude(currentTileKey);
+        if (motion < node->_cullMemoSlack) {
+            for (unsigned q = 0; q < 4; q++)
+                childPlaneMasks[q] = node->_cullMemoChildPlaneMasks[q];
 
-        float currentBaseDist = baseDist / pow2Level;
-        if (distSquared <= currentBaseDist * currentBaseDist)
-            return true;
+            context.memoizedDecisions++;
+            context.planeTestsSaved += 4 * FrustumCulling::NUM_PLANES;
+            return node->_cullMemoVisible;
+        }
     }
-    return false;
+
+    unsigned planeTests = 0;
+    float slack;
+    unsigned visible = FrustumCulling::cullBatch(camera.viewFrustum(), node->_childBounds, planeMask,
+        childPlaneMasks, node->_lastRejectingPlane, planeTests, slack);
+    context.planeTestsSaved += 4 * FrustumCulling::NUM_PLANES - planeTests;
+
+    const AABBBatch& bounds = node->_childBounds;
+    float reach = 0.0f;
+    for (unsigned q = 0; q < 4; q++) {
+        glm::vec3 center(bounds.centerX[q], bounds.centerY[q], bounds.centerZ[q]);
+        glm::vec3 extent(bounds.extentX[q], bounds.extentY[q], bounds.extentZ[q]);
+        reach = std::max(reach, glm::length(center - position) + glm::length(extent));
+    }
+
+    node->_cullMemoGeneration = _lodGeneration;
+    node->_cullMemoPlaneMask = planeMask;
+    node->_cullMemoVisible = visible;
+    for (unsigned q = 0; q < 4; q++)
+        node->_cullMemoChildPlaneMasks[q] = childPlaneMasks[q];
+    node->_cullMemoSlack = slack;
+    node->_cullMemoReach = reach;
+    node->_cullMemoPosition = position;
+    node->_cullMemoFront = front;
+    node->_cullMemoUp = up;
+
+    return visible;
 }
 
 /**
- * @brief TerrainManager::computeBaseDistWithLatitude
- * @param tileKey
+ * @brief TerrainManager::cameraMotion
+ *
+ * Upper bound of how far a point within the reach of the camera moved
+ * relative to the frustum planes since the camera had the given position
+ * and orientation, see cullChildren.
+ *
+ * @param camera
+ * @param position
+ * @param front
+ * @param up
+ * @param reach
  * @return
  */
-float TerrainManager::computeBaseDistWithLatitude(XYZTileKey tileKey)
+float TerrainManager::cameraMotion(Camera& camera, const glm::vec3& position, const glm::vec3& front, const glm::vec3& up, float reach)
 {
-    float baseDist = GlobalConstants::GLOBE_RADII.x * 3.5;
-    float pow2Level = (float)(1 << tileKey.z());
-
-    if (tileKey.z() >= 3 && std::abs(tileKey.y() / pow2Level - 0.5f) >= 0.3) {
-        baseDist *= 0.52;
-    } else if (tileKey.z() >= 3 && std::abs(tileKey.y() / pow2Level - 0.5f) >= 0.4) {
-        baseDist *= 0.41;
-    }
-
-    return baseDist;
+    return glm::length(camera.position() - position)
+        + reach * 4.0f * (glm::length(camera.front() - front) + glm::length(camera.up() - up));
 }
 
 /**
@@ -407,7 +1169,8 @@ float TerrainManager::computeBaseDistWithLatitude(XYZTileKey tileKey)
 void TerrainManager::initDiskCache()
 {
     /* Steps:
-     * - First traverse through all overlay tiles
+     * - Delete the leftovers of interrupted writes (*.part files)
+     * - Then traverse through all overlay tiles
      *      - If an overlay tile exists and a corresponding heightmap tile
      *        as well, put the tile key into a temporary list, otherwise
      *        delete overlay from disk
@@ -430,6 +1193,17 @@ void TerrainManager::initDiskCache()
     if (!std::filesystem::exists(cacheLocation + GlobalConstants::OVERLAY_DIR_NAME))
         std::filesystem::create_directory(cacheLocation + GlobalConstants::OVERLAY_DIR_NAME);
 
+    /* Partially written files are left behind if the application or a
+     * prewarm run is interrupted, they never become cache entries */
+    for (const std::string& dirName : { GlobalConstants::OVERLAY_DIR_NAME, GlobalConstants::HEIGHTDATA_DIR_NAME }) {
+        for (auto& entry : std::filesystem::directory_iterator(cacheLocation + dirName)) {
+            if (entry.path().extension() == ".part") {
+                std::error_code error;
+                std::filesystem::remove(entry.path(), error);
+            }
+        }
+    }
+
     std::unordered_map<XYZTileKey, std::string> traversed;
 
     /* First traverse overlay images */
@@ -441,7 +1215,7 @@ void TerrainManager::initDiskCache()
 
         if (std::regex_match(filename, matches, filePattern)) {
             std::string baseName = matches[1].str() + "_" + matches[2].str() + "_" + matches[3].str();
-            std::string tileKey = matches[1].str() + "/" + matches[2].str() + "/" + matches[3].str();
+            XYZTileKey tileKey(std::stoul(matches[1].str()), std::stoul(matches[2].str()), std::stoul(matches[3].str()));
             if (std::filesystem::exists(cacheLocation + GlobalConstants::HEIGHTDATA_DIR_NAME + baseName + ".webp"))
                 traversed[tileKey] = baseName;
             else {
@@ -459,7 +1233,7 @@ void TerrainManager::initDiskCache()
 
         if (std::regex_match(filename, matches, filePattern)) {
             std::string baseName = matches[1].str() + "_" + matches[2].str() + "_" + matches[3].str();
-            std::string tileKey = matches[1].str() + "/" + matches[2].str() + "/" + matches[3].str();
+            XYZTileKey tileKey(std::stoul(matches[1].str()), std::stoul(matches[2].str()), std::stoul(matches[3].str()));
             if (!traversed.count(tileKey)) {
                 std::filesystem::remove(cacheLocation + GlobalConstants::HEIGHTDATA_DIR_NAME + baseName + ".webp");
             }
@@ -467,20 +1241,20 @@ void TerrainManager::initDiskCache()
     }
 
     for (auto& entry : traversed) {
-        auto diskResult = _diskCache.put(entry.first, nullptr);
-        if (diskResult.evicted) {
-            auto evictedKey = diskResult.evictedItem.value().first;
-            auto evictedFile = traversed[evictedKey];
+        if (_diskCache.size() >= _diskCache.capacity()) {
             /* Check whether additional policies are in effect */
-            while (!checkEviction(evictedKey, nullptr)) {
-                diskResult = _diskCache.put(evictedKey, nullptr);
-                evictedKey = diskResult.evictedItem.value().first;
-                evictedFile = traversed[evictedKey];
-            }
+            auto evicted = _diskCache.evict([&](XYZTileKey key, void*) {
+                return checkEviction(key, nullptr);
+            });
+
             /* Remove evicted */
-            std::filesystem::remove(cacheLocation + GlobalConstants::HEIGHTDATA_DIR_NAME + evictedFile + ".webp");
-            std::filesystem::remove(cacheLocation + GlobalConstants::OVERLAY_DIR_NAME + evictedFile + ".jpg");
+            if (evicted) {
+                std::string evictedFile = traversed[evicted.value().first];
+                std::filesystem::remove(cacheLocation + GlobalConstants::HEIGHTDATA_DIR_NAME + evictedFile + ".webp");
+                std::filesystem::remove(cacheLocation + GlobalConstants::OVERLAY_DIR_NAME + evictedFile + ".jpg");
+            }
         }
+        _diskCache.put(entry.first, nullptr, false);
     }
 }
 
@@ -490,37 +1264,222 @@ void TerrainManager::initDiskCache()
 void TerrainManager::processAllDoneQueue()
 {
     std::deque<LoadResponse> responses = _doneQueue->popAll();
+    _integrationBacklog.insert(_integrationBacklog.end(), responses.begin(), responses.end());
+    _stats.integrationBacklog = 0;
 
-    for (auto response : responses) {
+    if (_integrationBacklog.empty())
+        return;
+
+    /* The camera may have moved since the tiles were requested. Both layers
+     * of a tile get the same priority, and the sort is stable, so that the
+     * overlay of a tile stays behind its heights. */
+    for (LoadResponse& response : _integrationBacklog)
+        response.priority = requestPriority(response.tileKey);
+
+    std::stable_sort(_integrationBacklog.begin(), _integrationBacklog.end(), [](const LoadResponse& a, const LoadResponse& b) {
+        return a.priority < b.priority;
+    });
+
+    /* Integrate the most important tiles until the budget is used up, but
+     * at least one per frame if there is room. The rest is left for the next
+     * frame. */
+    auto start = std::chrono::steady_clock::now();
+    std::size_t integrated = 0;
+
+    while (integrated < _integrationBacklog.size()) {
+        if (integrated > 0 && _integrationBudgetMicros > 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= _integrationBudgetMicros)
+                break;
+        }
+
+        /* Nodes wait in order if the memory cache has no room for them */
+        LoadResponse& response = _integrationBacklog[integrated];
+        if (response.layer == LOAD_LAYER_HEIGHT && response.type == LOAD_OK && !makeRoomForNode(response.tileKey))
+            break;
+
+        integrateResponse(response);
+        integrated++;
+    }
+
+    _integrationBacklog.erase(_integrationBacklog.begin(), _integrationBacklog.begin() + integrated);
+    _stats.integrationBacklog = _integrationBacklog.size();
+}
+
+/**
+ * @brief TerrainManager::requestPriority
+ *
+ * Estimates the screen space error of the tile from the camera of the last
+ * traversal. The geometric error of a tile roughly scales with its extent,
+ * so the extent of its bounds at height 0 divided by their distance is
+ * used, which is known before the tile is loaded. Larger errors come first,
+ * in steps of an eighth of a binary order of magnitude. Within a step,
+ * coarser tiles come first, since the finer tiles below them can only be
+ * drawn once they are resident.
+ *
+ * @param tileKey
+ * @return Priority of loading and integrating the tile, lower is more
+ *         important
+ */
+unsigned TerrainManager::requestPriority(XYZTileKey tileKey) const
+{
+    glm::vec3 aabbP1, aabbP2;
+    TerrainNode::computeAabb(tileKey, 0.0f, 0.0f, aabbP1, aabbP2);
+
+    glm::vec3 outside = glm::max(glm::max(aabbP1 - _cameraPosition, _cameraPosition - aabbP2), glm::vec3(0.0f));
+    float distance = std::max(glm::length(outside), 0.0001f);
+    float error = std::max(glm::length(aabbP2 - aabbP1), 0.0001f) / distance;
+
+    unsigned step = (unsigned)std::clamp(128.0f - 8.0f * std::log2(error), 0.0f, 255.0f);
+    return (step << 8) | tileKey.z();
+}
+
+/**
+ * @brief TerrainManager::integrateResponse Uploads a loaded tile layer and
+ *                                          inserts it into the caches
+ * @param response
+ */
+void TerrainManager::integrateResponse(LoadResponse& response)
+{
+    /* A successful height response is followed by the overlay */
+    if (response.layer == LOAD_LAYER_OVERLAY || response.type != LOAD_OK)
         _numberOfRequestedTiles--;
-        _loadingTiles.erase(response.tileKey.string());
 
-        if (response.origin == LOAD_ORIGIN_API) {
-            _stats.apiRequests += 2;
+    if (response.origin == LOAD_ORIGIN_API) {
+        _stats.apiRequests++;
+    }
+
+    if (response.layer == LOAD_LAYER_OVERLAY) {
+        processOverlayResponse(response);
+        return;
+    }
+
+    _loadingTiles.erase(response.tileKey);
+
+    /* Handle potential errors or unloadable tiles */
+    if (response.type == LOAD_UNLOADABLE || response.type == LOAD_TIMEOUT || response.type == LOAD_ERROR) {
+
+        if (response.type == LOAD_UNLOADABLE) {
+            _unloadableTileKeys.insert(response.tileKey);
+            setChildState(response.tileKey, TerrainNode::CHILD_UNLOADABLE);
+        } else {
+            setChildState(response.tileKey, TerrainNode::CHILD_ABSENT);
         }
 
-        /* Handle potential errors or unloadable tiles */
-        if (response.type == LOAD_UNLOADABLE || response.type == LOAD_TIMEOUT || response.type == LOAD_ERROR) {
+        if (response.type == LOAD_ERROR) {
+            _lastNetworkError = std::chrono::system_clock::now();
+            _offlineWait = true;
+        }
 
-            if (response.type == LOAD_UNLOADABLE)
-                _unloadableTileKeys.insert(response.tileKey.string());
+        if (response.heightData != nullptr) {
+            delete[] response.heightData;
+        }
+        if (response.overlayData != nullptr) {
+            stbi_image_free(response.overlayData);
+        }
+        delete response.node;
+        return;
+    }
 
-            if (response.type == LOAD_ERROR) {
-                _lastNetworkError = std::chrono::system_clock::now();
-                _offlineWait = true;
-            }
+    initTerrainNode(response);
+}
 
-            if (response.heightData != nullptr) {
-                delete[] response.heightData;
-            }
-            if (response.overlayData != nullptr) {
-                stbi_image_free(response.overlayData);
-            }
-            delete response.node;
+/**
+ * @brief TerrainManager::processPendingUploads
+ *
+ * Makes the textures of nodes usable once their uploads have completed.
+ * Nodes whose heights arrived become resident children of their parents.
+ */
+void TerrainManager::processPendingUploads()
+{
+    for (std::size_t i = 0; i < _pendingUploads.size();) {
+        PendingUpload upload = _pendingUploads[i];
+
+        if (!_texturePool->stagingSlotDone(upload.slot)) {
+            i++;
+            continue;
+        }
+
+        _texturePool->releaseStagingSlot(upload.slot);
+        _pendingUploads[i] = _pendingUploads.back();
+        _pendingUploads.pop_back();
+
+        TerrainNode* node = upload.node;
+
+        if (upload.layer == LOAD_LAYER_OVERLAY) {
+            node->_overlayState = TerrainNode::GPU_READY;
             continue;
-        } else
-            initTerrainNode(response);
+        }
+
+        node->_heightState = TerrainNode::GPU_READY;
+
+        if (node->_parent) {
+            node->_parent->_childStates[node->_xyzTileKey.quadrant()] = TerrainNode::CHILD_RESIDENT;
+            node->_parent->_cullMemoGeneration = 0;
+        }
+
+        invalidateCut(node);
     }
+
+    _stats.pendingUploads = _pendingUploads.size();
+}
+
+/**
+ * @brief TerrainManager::processOverlayResponse
+ *
+ * The node may have been evicted in the meantime, or may already have an
+ * overlay if it was evicted and loaded again.
+ *
+ * @param response
+ */
+void TerrainManager::processOverlayResponse(LoadResponse& response)
+{
+    auto node = _memoryCache.peek(response.tileKey);
+
+    if (response.type == LOAD_ERROR) {
+        _lastNetworkError = std::chrono::system_clock::now();
+        _offlineWait = true;
+    }
+
+    /* Both layers are on disk now */
+    if (response.type == LOAD_OK)
+        indexDiskCache(response.tileKey);
+    else if (!node || response.type == LOAD_UNLOADABLE)
+        discardHeightmap(response.tileKey);
+
+    if (!node || node.value()->_overlayState == TerrainNode::GPU_READY
+        || node.value()->_overlayState == TerrainNode::LOADING_FROM_MEMORY) {
+        if (response.overlayData != nullptr)
+            stbi_image_free(response.overlayData);
+        delete[] response.overlayMipmaps;
+        return;
+    }
+
+    if (response.type == LOAD_OK)
+        initOverlay(node.value(), response);
+    else if (response.type == LOAD_UNLOADABLE)
+        node.value()->_overlayState = TerrainNode::UNDOWNLOADABLE;
+    else {
+        node.value()->_overlayState = TerrainNode::DOWNLOADABLE; /* Try again later */
+        invalidateCut(node.value());
+    }
+}
+
+/**
+ * @brief TerrainManager::requestOverlay Requests the overlay of a resident
+ *                                       node whose overlay failed to load
+ * @param node
+ */
+void TerrainManager::requestOverlay(TerrainNode* node)
+{
+    if (node->_overlayState != TerrainNode::DOWNLOADABLE || _offlineWait)
+        return;
+
+    node->_overlayState = TerrainNode::DOWNLOADING_FROM_API;
+    _loadRequestQueues[_currentLoadThread]->push({ node->_xyzTileKey, LOAD_REQUEST_OVERLAY, false, requestPriority(node->_xyzTileKey) });
+
+    _currentLoadThread = (_currentLoadThread + 1) % _numLoadWorkers;
+    _numberOfRequestedTiles++;
 }
 
 /**
@@ -530,8 +1489,11 @@ void TerrainManager::processAllUnloadDoneQueue()
 {
     std::deque<DiskDeallocationResponse> responses = _unloadDoneQueue->popAll();
 
+    if (!responses.empty())
+        _treeVersion++;
+
     for (auto response : responses) {
-        _currentDiskCacheEvictions.erase(response.tileKey.string());
+        _currentDiskCacheEvictions.erase(response.tileKey);
         if (response.type != UNLOAD_OK) {
             std::cerr << "Something went wrong disk dealloc" << std::endl;
         }
@@ -554,71 +1516,124 @@ void TerrainManager::render(Camera& camera, bool wireframe, bool aabb, bool& col
     _stats.deepestZoomLevel = 0;
     _stats.visibleNodes = 0;
     _stats.traversedNodes = 0;
+    _stats.reusedSubtrees = 0;
+    _stats.traversalMicros = 0;
+    _stats.planeTestsSaved = 0;
+    _stats.memoizedDecisions = 0;
+    _stats.lodCutReused = false;
+    _stats.traversalTasks = 0;
+    _stats.culledChildren = 0;
+    _stats.skipLevelRequests = 0;
+
+    /* Other code may have changed the GL state since the last frame */
+    GlStateCache* glState = GlStateCache::getInstance();
+    glState->invalidate();
+    glState->resetFilteredCalls();
 
     /* Check if still waiting for network error */
     if (_offlineWait) {
         auto now = std::chrono::system_clock::now();
         if (std::abs(std::chrono::duration_cast<std::chrono::seconds>(now - _lastNetworkError).count()) > 5) {
             _offlineWait = false;
+            _treeVersion++;
         }
     }
 
     /* Process concurrent message queues */
+    processPendingUploads();
     processAllDoneQueue();
     processAllUnloadDoneQueue();
 
     /* Wait until the root node is loaded */
-    if (!_memoryCache.contains(XYZTileKey(0, 0, 0)))
+    if (_root == nullptr || _root->_heightState != TerrainNode::GPU_READY)
         return;
 
-    std::queue<std::string> visibleNodes;
-    XYZTileKey minimumDistanceTileKey(0, 0, 0);
-    float minimumDistance = 99999.9f;
-    collectRenderable(camera, XYZTileKey(0, 0, 0), visibleNodes, minimumDistanceTileKey, minimumDistance);
+    bool generationChanged = updateLodGeneration(camera);
+    bool cameraMoved = camera.position() != _lastCameraPosition
+        || camera.front() != _lastCameraFront
+        || camera.up() != _lastCameraUp;
 
-    collision = checkCollision(camera, minimumDistanceTileKey, verticalCollisionOffset);
+    /* Reuse the last LOD cut if neither the camera nor the tree changed,
+     * otherwise update it where it may have changed */
+    if (generationChanged || cameraMoved || _treeVersion != _lastTreeVersion) {
+        auto traversalStart = std::chrono::steady_clock::now();
+        HorizonCullingCamera horizonCullingCamera(camera.position());
+        _horizonCullingCamera = &horizonCullingCamera;
 
-    _stats.visibleNodes = visibleNodes.size();
+        traverse(camera);
 
-    /* Render all visible tiles (front-to-back) */
-    while (!visibleNodes.empty()) {
-        auto topKey = visibleNodes.front();
-        visibleNodes.pop();
+        _horizonCullingCamera = nullptr;
+        _stats.traversalMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - traversalStart).count();
 
-        auto result = _memoryCache.get(topKey);
-        TerrainNode* node = result.value();
+        _lastMinimumDistanceTileKey = findMinimumDistanceTileKey(camera);
+        _lastCameraPosition = camera.position();
+        _lastCameraFront = camera.front();
+        _lastCameraUp = camera.up();
+        _lastTreeVersion = _treeVersion;
+    } else {
+        _stats.lodCutReused = true;
+    }
 
-        _stats.deepestZoomLevel = std::max(node->_xyzTileKey.z(), _stats.deepestZoomLevel);
+    collision = checkCollision(camera, _lastMinimumDistanceTileKey, verticalCollisionOffset);
 
-        if (XYZTileKey(topKey).z() <= 9)
-            renderNode(camera, node, LOW, wireframe, aabb);
-        else if (XYZTileKey(topKey).z() <= 11)
-            renderNode(camera, node, MEDIUM, wireframe, aabb);
-        else
-            renderNode(camera, node, HIGH, wireframe, aabb);
-    }
+    _stats.visibleNodes = _visibleNodes.size();
+    _stats.multiDrawIndirect = _multiDrawIndirect;
+    _stats.pipelineStatistics = _pipelineStatistics;
 
-    /* Render north and south poles */
-    glBindVertexArray(_poleMesh->_vao);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _poleMesh->_ebo);
+    auto submitStart = std::chrono::steady_clock::now();
 
-    if (wireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    /* The textures of all nodes are layers of the same arrays */
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _texturePool->_overlayArrayId);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _texturePool->_heightmapArrayId);
+
+    glState->setPolygonMode(wireframe ? GL_LINE : GL_FILL);
+
+    /* Render all visible tiles, sorted by program and mesh */
+    beginInvocationQuery();
+
+    if (_tessellationEdgeLength > 0)
+        renderNodesTessellated(wireframe);
+    else if (_multiDrawIndirect)
+        renderNodesIndirect();
+    else
+        renderNodes(wireframe);
+
+    endInvocationQuery();
+
+    if (aabb) {
+        glState->setPolygonMode(GL_LINE);
+        for (const RenderItem& item : _visibleNodes)
+            renderAabb(item.node);
+        glState->setPolygonMode(wireframe ? GL_LINE : GL_FILL);
     }
 
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    for (const RenderItem& item : _visibleNodes)
+        _stats.deepestZoomLevel = std::max(item.node->_xyzTileKey.z(), _stats.deepestZoomLevel);
+
+    _stats.submitMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - submitStart).count();
+
+    /* Render north and south poles */
     _poleShader.use();
-    _poleShader.setFloat("isNorthPole", (float)true);
+    _poleShader.setFloat(_isNorthPoleLocation, (float)true);
     _poleMesh->render();
 
     /* TODO: This is a temporary hacky fix */
-    _poleShader.setFloat("isNorthPole", (float)false);
-    glCullFace(GL_FRONT);
+    _poleShader.setFloat(_isNorthPoleLocation, (float)false);
+    glState->setCullFace(GL_FRONT);
     _poleMesh->render();
-    glCullFace(GL_BACK);
+    glState->setCullFace(GL_BACK);
 
-    if (wireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    }
+    /* Leave the defaults for the skybox and the UI */
+    glState->setPolygonMode(GL_FILL);
+    glState->setPrimitiveRestart(false, PoleMesh::RESTART_INDEX);
+    glState->bindVertexArray(0);
 
     _stats.drawCalls += 2;
     _stats.renderedTriangles += _poleMesh->_numRadians;
@@ -626,120 +1641,523 @@ void TerrainManager::render(Camera& camera, bool wireframe, bool aabb, bool& col
     _stats.numberOfDiskCacheEntries = _diskCache.size();
     _stats.numberOfNodes = _memoryCache.size();
     _stats.waitOffline = _offlineWait;
+    _stats.filteredStateChanges = glState->filteredCalls();
 }
 
 /**
- * @brief TerrainManager::renderTile
+ * @brief TerrainManager::updateLodGeneration
+ *
+ * Invalidates all memoized LOD decisions if the projection or the tolerance
+ * changed, or if the camera jumped far compared to its altitude. In the
+ * latter case the memos would hardly ever hold anyway.
+ *
  * @param camera
- * @param tile
+ * @return Whether the generation changed
  */
-void TerrainManager::renderNode(Camera& camera, TerrainNode* node, TileResolution resolution, bool wireframe, bool aabb)
+bool TerrainManager::updateLodGeneration(Camera& camera)
 {
-    unsigned zoom = node->_xyzTileKey.z();
+    float screenSpaceErrorFactor = camera.screenSpaceErrorFactor();
+    float altitude = std::max(glm::length(camera.position()) - GlobalConstants::GLOBE_RADII.x, 0.01f);
+    bool largeJump = glm::length(camera.position() - _lastCameraPosition) > 0.5f * altitude;
+
+    if (screenSpaceErrorFactor != _screenSpaceErrorFactor
+        || _pixelTolerance != _lastPixelTolerance
+        || camera.aspectRatio() != _lastAspectRatio
+        || largeJump) {
+        _screenSpaceErrorFactor = screenSpaceErrorFactor;
+        _lastPixelTolerance = _pixelTolerance;
+        _lastAspectRatio = camera.aspectRatio();
+        _lodGeneration++;
+        return true;
+    }
 
-    unsigned sideLength;
-    GridMesh* gridMesh;
-    SkirtMesh* skirtMesh;
-
-    switch (resolution) {
-    case LOW:
-        sideLength = _tileSideLengthLowRes;
-        gridMesh = _gridMeshLow;
-        skirtMesh = _skirtMeshLow;
-        break;
-    case MEDIUM:
-        sideLength = _tileSideLengthMediumRes;
-        gridMesh = _gridMeshMedium;
-        skirtMesh = _skirtMeshMedium;
-        break;
-    case HIGH:
-        sideLength = _tileSideLengthHighRes;
-        gridMesh = _gridMeshHigh;
-        skirtMesh = _skirtMeshHigh;
-        break;
-    }
-
-    glBindVertexArray(skirtMesh->_vao);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, skirtMesh->_ebo);
+    return false;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, node->_overlayTextureId);
+/**
+ * @brief TerrainManager::tileResolution
+ * @param zoom
+ * @return The mesh resolution used for nodes of this zoom level
+ */
+TileResolution TerrainManager::tileResolution(unsigned zoom)
+{
+    if (zoom <= GlobalConstants::LOW_RES_MESH_MAX_ZOOM)
+        return LOW;
+    else if (zoom <= GlobalConstants::MEDIUM_RES_MESH_MAX_ZOOM)
+        return MEDIUM;
+    else
+        return HIGH;
+}
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, node->_heightmapTextureId);
+/**
+ * @brief TerrainManager::quadrantRect
+ * @param quadrant A quadrant or RenderItem::WHOLE_NODE
+ * @return Part of the tile to draw, as offset and scale in normalized tile
+ *         coordinates
+ */
+glm::vec4 TerrainManager::quadrantRect(unsigned quadrant)
+{
+    if (quadrant == RenderItem::WHOLE_NODE)
+        return glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+    return glm::vec4((quadrant & 1) * 0.5f, (quadrant >> 1) * 0.5f, 0.5f, 0.5f);
+}
+
+/**
+ * @brief TerrainManager::overlaySource
+ *
+ * Finds the overlay to draw a node with. This is the overlay of the nearest
+ * ancestor until the node's own overlay has arrived.
+ *
+ * @param node
+ * @param overlayRect Maps the tile coordinates of the node into the overlay,
+ *                    a zero scale means that there is no overlay
+ * @return The node which owns the overlay, or nullptr
+ */
+TerrainNode* TerrainManager::overlaySource(TerrainNode* node, glm::vec4& overlayRect)
+{
+    TerrainNode* overlayNode = node;
+    unsigned levelsUp = 0;
+    while (overlayNode && overlayNode->_overlayState != TerrainNode::GPU_READY) {
+        overlayNode = overlayNode->_parent;
+        levelsUp++;
+    }
 
-    _skirtShader.use();
+    overlayRect = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
 
-    _skirtShader.setFloat("tileWidth", sideLength);
-    _skirtShader.setFloat("zoom", zoom);
-    _skirtShader.setVec2("tileKey", glm::vec2((float)node->_xyzTileKey.x(), (float)node->_xyzTileKey.y()));
+    if (overlayNode) {
+        unsigned mask = (1u << levelsUp) - 1;
+        float scale = 1.0f / (float)(1u << levelsUp);
+        overlayRect = glm::vec4((node->_xyzTileKey.x() & mask) * scale, (node->_xyzTileKey.y() & mask) * scale, scale, scale);
+    }
 
-    if (wireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        skirtMesh->render();
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    } else {
-        skirtMesh->render();
+    return overlayNode;
+}
+
+/**
+ * @brief TerrainManager::renderNodesIndirect
+ *
+ * Draws all visible nodes with one glMultiDrawElementsIndirect call per mesh.
+ * The nodes are grouped by resolution, but stay in front-to-back order
+ * within each group. The fragment shader picks the wireframe colors from
+ * the zoom level of each node itself.
+ */
+void TerrainManager::renderNodesIndirect()
+{
+    GridMesh* gridMeshes[3] = { _gridMeshLow, _gridMeshMedium, _gridMeshHigh };
+    unsigned sideLengths[3] = { _tileSideLengthLowRes, _tileSideLengthMediumRes, _tileSideLengthHighRes };
+
+    for (auto& instances : _tileInstances)
+        instances.clear();
+
+    for (const RenderItem& item : _visibleNodes) {
+        TerrainNode* node = item.node;
+        unsigned zoom = node->_xyzTileKey.z();
+        TileResolution resolution = tileResolution(zoom);
+
+        TileInstance instance;
+        instance.subRect = quadrantRect(item.quadrant);
+        TerrainNode* overlayNode = overlaySource(node, instance.overlayRect);
+        instance.tile = glm::vec4((float)node->_xyzTileKey.x(), (float)node->_xyzTileKey.y(), (float)zoom, (float)sideLengths[resolution]);
+        int parentLayer;
+        instance.morph = morphParameters(node, parentLayer);
+        instance.layers = glm::ivec4(node->_textureLayer, overlayNode ? overlayNode->_textureLayer : -1, parentLayer, 0);
+
+        _tileInstances[resolution].push_back(instance);
+    }
+
+    /* Concatenate the groups, each node gets one command, whose base
+     * instance is the index of its parameters */
+    _instanceUpload.clear();
+    _indirectCommands.clear();
+
+    std::size_t commandOffsets[3];
+
+    for (unsigned r = 0; r < 3; r++) {
+        GLuint baseInstance = _instanceUpload.size();
+        std::size_t count = _tileInstances[r].size();
+        _instanceUpload.insert(_instanceUpload.end(), _tileInstances[r].begin(), _tileInstances[r].end());
+
+        commandOffsets[r] = _indirectCommands.size();
+        for (std::size_t i = 0; i < count; i++)
+            _indirectCommands.push_back({ (GLuint)gridMeshes[r]->_indices.size(), 1, 0, 0, baseInstance + (GLuint)i });
     }
 
-    glBindVertexArray(gridMesh->_vao);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gridMesh->_ebo);
+    if (_instanceUpload.empty())
+        return;
+
+    /* The draw IDs are sized for the memory cache, grow them just in case */
+    if (_instanceUpload.size() > _drawIdCapacity) {
+        _drawIdCapacity = 2 * _instanceUpload.size();
+        std::vector<GLuint> drawIds(_drawIdCapacity);
+        for (unsigned i = 0; i < _drawIdCapacity; i++)
+            drawIds[i] = i;
+
+        glBindBuffer(GL_ARRAY_BUFFER, _drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    /* Orphan and refill both buffers every frame */
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _instanceBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _instanceUpload.size() * sizeof(TileInstance), _instanceUpload.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _instanceBuffer);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, _indirectCommands.size() * sizeof(DrawElementsIndirectCommand), _indirectCommands.data(), GL_STREAM_DRAW);
+
+    GlStateCache* glState = GlStateCache::getInstance();
 
     _terrainShader.use();
+    for (unsigned r = 0; r < 3; r++) {
+        GLsizei count = _tileInstances[r].size();
+        if (count == 0)
+            continue;
 
-    /* Set colors for debug wireframe view */
-    if (wireframe) {
-        if (zoom % 3 == 0) {
-            _terrainShader.setVec3("terrainColor", glm::vec3(1, 0, 0));
-        } else if (zoom % 3 == 1) {
-            _terrainShader.setVec3("terrainColor", glm::vec3(0, 1, 0));
+        glState->bindVertexArray(gridMeshes[r]->_vao);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, gridMeshes[r]->indexType(),
+            (void*)(commandOffsets[r] * sizeof(DrawElementsIndirectCommand)), count, 0);
 
-        } else {
-            _terrainShader.setVec3("terrainColor", glm::vec3(0, 0, 1));
+        _stats.drawCalls++;
+        _stats.renderedTriangles += count * gridMeshes[r]->triangleCount();
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    Util::checkGlError("Error while rendering nodes indirectly");
+}
+
+/**
+ * @brief TerrainManager::beginInvocationQuery Starts counting the vertex
+ *        shader invocations of the terrain draws, if supported.
+ *
+ * The queries are used round-robin, so that a result is read a few frames
+ * after it was issued without stalling. A result that is still not
+ * available is skipped.
+ */
+void TerrainManager::beginInvocationQuery()
+{
+    if (!_pipelineStatistics)
+        return;
+
+    unsigned query = _invocationQueryFrame % INVOCATION_QUERIES;
+
+    if (_invocationQueryIssued[query]) {
+        GLint available = 0;
+        glGetQueryObjectiv(_invocationQueries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available) {
+            GLuint invocations = 0;
+            glGetQueryObjectuiv(_invocationQueries[query], GL_QUERY_RESULT, &invocations);
+            _stats.vertexShaderInvocations = invocations;
         }
     }
 
-    _terrainShader.setFloat("tileWidth", sideLength);
-    _terrainShader.setFloat("zoom", zoom);
-    _terrainShader.setVec2("tileKey", glm::vec2((float)node->_xyzTileKey.x(), (float)node->_xyzTileKey.y()));
+    glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, _invocationQueries[query]);
+    _invocationQueryIssued[query] = true;
+}
 
-    if (wireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        gridMesh->render();
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    } else {
-        gridMesh->render();
+/**
+ * @brief TerrainManager::endInvocationQuery
+ */
+void TerrainManager::endInvocationQuery()
+{
+    if (!_pipelineStatistics)
+        return;
+
+    glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+    _invocationQueryFrame++;
+}
+
+/**
+ * @brief TerrainManager::renderNodes Draws the visible nodes with one draw
+ *        call per node.
+ *
+ * The nodes are sorted into a queue per resolution, so that the mesh
+ * changes three times per frame at most. Sorting is stable, within a mesh
+ * the nodes stay front-to-back. The textures are not part of the sort, since
+ * all nodes share the same texture arrays.
+ *
+ * @param wireframe
+ */
+void TerrainManager::renderNodes(bool wireframe)
+{
+    GridMesh* gridMeshes[3] = { _gridMeshLow, _gridMeshMedium, _gridMeshHigh };
+    unsigned sideLengths[3] = { _tileSideLengthLowRes, _tileSideLengthMediumRes, _tileSideLengthHighRes };
+
+    for (auto& queue : _renderQueues)
+        queue.clear();
+
+    for (const RenderItem& item : _visibleNodes)
+        _renderQueues[tileResolution(item.node->_xyzTileKey.z())].push_back(item);
+
+    _terrainShader.use();
+    for (unsigned r = 0; r < 3; r++) {
+        for (const RenderItem& item : _renderQueues[r]) {
+            setNodeUniforms(_terrainShader, _terrainUniforms, item, sideLengths[r], wireframe);
+            gridMeshes[r]->render();
+        }
+
+        _stats.drawCalls += _renderQueues[r].size();
+        _stats.renderedTriangles += _renderQueues[r].size() * gridMeshes[r]->triangleCount();
     }
 
-    if (aabb) {
-        _aabbShader.use();
-        _aabbShader.setVec3("center", (node->_aabbP1 + node->_aabbP2) / 2.0f);
-        glm::vec3 size = (node->_aabbP2 - node->_aabbP1);
-        glm::vec3 center = (node->_aabbP1 + node->_aabbP2) / 2.0f;
-        glm::mat4 transform = glm::translate(glm::mat4(1), center) * glm::scale(glm::mat4(1), size);
-        _aabbShader.setMat4("model", transform);
+    Util::checkGlError("Error while rendering nodes");
+}
 
+/**
+ * @brief TerrainManager::renderNodesTessellated Draws each visible node as
+ *        the patches of the patch mesh.
+ *
+ * The tessellation levels are chosen per patch edge in the control shader,
+ * from the screen space size of the edge and the height variation of the
+ * node. The edges on the border of a node only depend on the border, see
+ * computeTessellationBorders. The mesh resolutions are not used.
+ *
+ * @param wireframe
+ */
+void TerrainManager::renderNodesTessellated(bool wireframe)
+{
+    _tessellationShader.use();
+    _tessellationShader.setFloat(_tessellationScaleLocation, _screenSpaceErrorFactor / (float)_tessellationEdgeLength);
+
+    computeTessellationBorders();
+
+    for (unsigned i = 0; i < _visibleNodes.size(); i++) {
+        const RenderItem& item = _visibleNodes[i];
+        setNodeUniforms(_tessellationShader, _tessellationUniforms, item, PatchMesh::PATCHES_PER_SIDE + 1, wireframe);
+        _tessellationShader.setFloat(_detailLocation, tessellationDetail(item.node));
+        _tessellationShader.setVec4(_borderCoarserLocation, _borderCoarser[i]);
+        _tessellationShader.setVec4(_borderMinExponentLocation, _borderMinExponent[i]);
+        _patchMesh->render();
+    }
+
+    /* Lower bound, the tessellator adds the rest on the GPU */
+    _stats.drawCalls += _visibleNodes.size();
+    _stats.renderedTriangles += _visibleNodes.size() * _patchMesh->patchCount() * 2;
+
+    Util::checkGlError("Error while rendering tessellated nodes");
+}
+
+/**
+ * @brief TerrainManager::computeTessellationBorders Finds the neighbours of
+ *        the visible nodes, so that the tessellation levels of their shared
+ *        borders match.
+ *
+ * A drawn quadrant counts as the child tile it covers. The level of a
+ * border edge is derived in the control shader from the patch edge of the
+ * coarser side, at height 0, and rounded to a power of two. The finer side
+ * divides it by 2 per zoom level of difference, so that both sides place
+ * the same vertices on the border. For the sides of each node, this
+ * computes
+ * - by how many zoom levels the neighbour is coarser, 0 if it is not, and
+ * - the smallest exponent of the level of the coarser side's edges, so
+ *   that the finest neighbour along it still gets a level of at least 2.
+ *
+ * The sides are in the order u = 0, v = 0, u = 1, v = 1 of the patch mesh.
+ * Neighbours are only known if they are visible, culled neighbours do not
+ * constrain the level.
+ */
+void TerrainManager::computeTessellationBorders()
+{
+    static constexpr int OFFSET_X[4] = { -1, 0, 1, 0 };
+    static constexpr int OFFSET_Y[4] = { 0, -1, 0, 1 };
+    static constexpr unsigned NO_NEIGHBOUR = std::numeric_limits<unsigned>::max();
+
+    unsigned numItems = _visibleNodes.size();
+    std::vector<XYZTileKey> pieceKeys(numItems);
+    std::vector<glm::uvec4> neighbours(numItems, glm::uvec4(NO_NEIGHBOUR));
+    std::vector<glm::vec4> finer(numItems, glm::vec4(0.0f));
+
+    _tessellationPieces.clear();
+    _borderCoarser.assign(numItems, glm::vec4(0.0f));
+    _borderMinExponent.resize(numItems);
+
+    for (unsigned i = 0; i < numItems; i++) {
+        const RenderItem& item = _visibleNodes[i];
+        XYZTileKey nodeKey = item.node->_xyzTileKey;
+        pieceKeys[i] = item.quadrant == RenderItem::WHOLE_NODE ? nodeKey : nodeKey.child(item.quadrant);
+        _tessellationPieces[pieceKeys[i]] = i;
+    }
+
+    /* The visible nodes do not overlap, so at most one ancestor of the
+     * neighbouring key is drawn */
+    for (unsigned i = 0; i < numItems; i++) {
+        XYZTileKey key = pieceKeys[i];
+        long numTiles = 1L << key.z();
+
+        for (unsigned s = 0; s < 4; s++) {
+            long y = (long)key.y() + OFFSET_Y[s];
+            if (y < 0 || y >= numTiles)
+                continue;
+
+            long x = ((long)key.x() + OFFSET_X[s] + numTiles) % numTiles;
+            XYZTileKey neighbourKey((unsigned)x, (unsigned)y, key.z());
+
+            for (unsigned delta = 0;; delta++) {
+                auto neighbour = _tessellationPieces.find(neighbourKey);
+                if (neighbour != _tessellationPieces.end()) {
+                    unsigned j = neighbour->second;
+                    unsigned opposite = (s + 2) % 4;
+
+                    neighbours[i][s] = j;
+                    _borderCoarser[i][s] = (float)delta;
+                    finer[j][opposite] = std::max(finer[j][opposite], (float)delta);
+                    break;
+                }
+
+                if (neighbourKey.z() == 0)
+                    break;
+                neighbourKey = neighbourKey.parent();
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < numItems; i++) {
+        for (unsigned s = 0; s < 4; s++) {
+            bool coarser = _borderCoarser[i][s] > 0.0f;
+            _borderMinExponent[i][s] = (coarser ? finer[neighbours[i][s]][(s + 2) % 4] : finer[i][s]) + 1.0f;
+        }
+    }
+}
+
+/**
+ * @brief TerrainManager::tessellationDetail Scales the tessellation inside a
+ *        node by how rugged it is. Tiles whose height range reaches
+ *        FULL_DETAIL_RELIEF of their width are tessellated fully, flat tiles
+ *        down to MIN_TESSELLATION_DETAIL.
+ * @param node
+ * @return
+ */
+float TerrainManager::tessellationDetail(TerrainNode* node)
+{
+    static constexpr float FULL_DETAIL_RELIEF = 0.05f;
+    static constexpr float MIN_TESSELLATION_DETAIL = 0.25f;
+
+    float width = glm::two_pi<float>() * GlobalConstants::GLOBE_RADII.x / (float)(1 << node->_xyzTileKey.z());
+    float relief = (node->_maxHeight - node->_minHeight) / width;
+
+    return std::max(std::min(relief / FULL_DETAIL_RELIEF, 1.0f), MIN_TESSELLATION_DETAIL);
+}
+
+/**
+ * @brief TerrainManager::setNodeUniforms Sets the per node uniforms of the
+ *        terrain shader, which must be in use.
+ * @param shader
+ * @param uniforms
+ * @param item
+ * @param sideLength
+ * @param wireframe Whether to set the debug color of the zoom level
+ */
+void TerrainManager::setNodeUniforms(const Shader& shader, const NodeUniforms& uniforms, const RenderItem& item, unsigned sideLength, bool wireframe)
+{
+    TerrainNode* node = item.node;
+    unsigned zoom = node->_xyzTileKey.z();
+
+    glm::vec4 overlayRect;
+    TerrainNode* overlayNode = overlaySource(node, overlayRect);
+    int overlayLayer = overlayNode ? overlayNode->_textureLayer : -1;
+
+    int parentLayer;
+    glm::vec4 morph = morphParameters(node, parentLayer);
+
+    /* Set colors for debug wireframe view */
+    if (wireframe) {
         if (zoom % 3 == 0) {
-            _aabbShader.setVec3("color", glm::vec3(1, 0, 0));
+            shader.setVec3(uniforms.terrainColor, glm::vec3(1, 0, 0));
         } else if (zoom % 3 == 1) {
-            _aabbShader.setVec3("color", glm::vec3(0, 1, 0));
-
+            shader.setVec3(uniforms.terrainColor, glm::vec3(0, 1, 0));
         } else {
-            _aabbShader.setVec3("color", glm::vec3(0, 0, 1));
+            shader.setVec3(uniforms.terrainColor, glm::vec3(0, 0, 1));
         }
+    }
 
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        _aabbMesh->render();
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    shader.setFloat(uniforms.tileWidth, sideLength);
+    shader.setFloat(uniforms.zoom, zoom);
+    shader.setVec2(uniforms.tileKey, glm::vec2((float)node->_xyzTileKey.x(), (float)node->_xyzTileKey.y()));
+    shader.setVec4(uniforms.subRect, quadrantRect(item.quadrant));
+    shader.setVec4(uniforms.overlayRect, overlayRect);
+    shader.setInt(uniforms.heightmapLayer, node->_textureLayer);
+    shader.setInt(uniforms.overlayLayer, overlayLayer);
+    shader.setInt(uniforms.parentHeightmapLayer, parentLayer);
+    shader.setVec4(uniforms.morph, morph);
+}
 
-        _stats.drawCalls++;
-        _stats.renderedTriangles += 12;
+/**
+ * @brief TerrainManager::morphParameters Computes how far a node has morphed
+ *        from the heights of its parent towards its own.
+ *
+ * The parent is split closer than its split distance. The node morphs while
+ * the camera covers the last morph range fraction of that distance, so that
+ * it matches its parent right after the split. The window ends no closer
+ * than the node's own split distance. The node is no closer than its parent's
+ * box, which encloses the node's up to the height sampling. So the node has
+ * its own heights before it could be split itself, and its children morph
+ * from heights it actually showed. The distance is measured
+ * like in shouldSplit, from the camera position of the last traversal.
+ *
+ * @param node
+ * @param parentLayer Set to the heightmap layer of the parent, -1 if the node
+ *                    does not morph
+ * @return Offset of the node in its parent (xy), side length of the parent's
+ *         mesh (z) and the morph factor (w), which is 1 for the node's own
+ *         heights
+ */
+glm::vec4 TerrainManager::morphParameters(TerrainNode* node, int& parentLayer)
+{
+    TerrainNode* parent = node->_parent;
+    parentLayer = -1;
+
+    if (_morphRange <= 0.0f || parent == nullptr || parent->_heightState != TerrainNode::GPU_READY)
+        return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    glm::vec3 outside = glm::max(glm::max(parent->_aabbP1 - _lastCameraPosition, _lastCameraPosition - parent->_aabbP2), glm::vec3(0.0f));
+    float distance = glm::length(outside);
+    float splitDistance = parent->_geometricError * _screenSpaceErrorFactor / _pixelTolerance;
+    float nodeSplitDistance = node->_geometricError * _screenSpaceErrorFactor / _pixelTolerance;
+    float window = std::min(_morphRange * splitDistance, splitDistance - nodeSplitDistance);
+
+    if (window <= 0.0f)
+        return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    float morph = glm::clamp((splitDistance - distance) / window, 0.0f, 1.0f);
+
+    unsigned sideLengths[3] = { _tileSideLengthLowRes, _tileSideLengthMediumRes, _tileSideLengthHighRes };
+    unsigned parentSideLength = sideLengths[tileResolution(parent->_xyzTileKey.z())];
+
+    parentLayer = parent->_textureLayer;
+    return glm::vec4((node->_xyzTileKey.x() & 1) * 0.5f, (node->_xyzTileKey.y() & 1) * 0.5f, (float)parentSideLength, morph);
+}
+
+/**
+ * @brief TerrainManager::renderAabb Draws the bounding box of a node for
+ *                                   debugging
+ * @param node
+ */
+void TerrainManager::renderAabb(TerrainNode* node)
+{
+    unsigned zoom = node->_xyzTileKey.z();
+
+    _aabbShader.use();
+    _aabbShader.setVec3("center", (node->_aabbP1 + node->_aabbP2) / 2.0f);
+    glm::vec3 size = (node->_aabbP2 - node->_aabbP1);
+    glm::vec3 center = (node->_aabbP1 + node->_aabbP2) / 2.0f;
+    glm::mat4 transform = glm::translate(glm::mat4(1), center) * glm::scale(glm::mat4(1), size);
+    _aabbShader.setMat4("model", transform);
+
+    if (zoom % 3 == 0) {
+        _aabbShader.setVec3("color", glm::vec3(1, 0, 0));
+    } else if (zoom % 3 == 1) {
+        _aabbShader.setVec3("color", glm::vec3(0, 1, 0));
+
+    } else {
+        _aabbShader.setVec3("color", glm::vec3(0, 0, 1));
     }
 
-    Util::checkGlError("Error while rendering node");
+    _aabbMesh->render();
 
-    _stats.drawCalls += 2;
-    _stats.renderedTriangles += (sideLength * sideLength * 2) + (sideLength * 4 * 2);
+    _stats.drawCalls++;
+    _stats.renderedTriangles += 12;
 }
 
 /**
@@ -752,7 +2170,7 @@ void TerrainManager::renderNode(Camera& camera, TerrainNode* node, TileResolutio
 bool TerrainManager::checkCollision(Camera& camera, XYZTileKey minimumDistanceTileKey, float& verticalCollisionOffset)
 {
 
-    TerrainNode* currentNode = _memoryCache.get(minimumDistanceTileKey.string()).value();
+    TerrainNode* currentNode = _memoryCache.peek(minimumDistanceTileKey).value();
 
     glm::vec2 lonlat = MapProjections::toGeodetic2D(camera.position(), GlobalConstants::GLOBE_RADII_SQUARED);
 
@@ -798,10 +2216,10 @@ bool TerrainManager::checkCollision(Camera& camera, XYZTileKey minimumDistanceTi
  */
 bool TerrainManager::hasChildren(XYZTileKey tileKey)
 {
-    return _memoryCache.contains(tileKey.topLeftChild().string())
-        || _memoryCache.contains(tileKey.topRightChild().string())
-        || _memoryCache.contains(tileKey.bottomLeftChild().string())
-        || _memoryCache.contains(tileKey.bottomRightChild().string());
+    return _memoryCache.contains(tileKey.topLeftChild())
+        || _memoryCache.contains(tileKey.topRightChild())
+        || _memoryCache.contains(tileKey.bottomLeftChild())
+        || _memoryCache.contains(tileKey.bottomRightChild());
 }
 
 /**
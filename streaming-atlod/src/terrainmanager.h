@@ -2,7 +2,6 @@
 #define TERRAINMANAGER_H
 
 #include <list>
-#include <queue>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -11,17 +10,19 @@
 
 #include "aabbmesh.h"
 #include "camera.h"
+#include "flatlrucache.h"
 #include "gridmesh.h"
 #include "loadworkerthread.h"
-#include "lrucache.h"
 #include "messagequeue.h"
+#include "patchmesh.h"
 #include "polemesh.h"
 #include "renderstatistics.h"
 #include "shader.h"
-#include "skirtmesh.h"
+#include "taskpool.h"
+#include "terrainnode.h"
+#include "texturepool.h"
 #include "diskdeallocationworkerthread.h"
 #include "xyztilekey.h"
-class TerrainNode;
 
 enum TileResolution {
     LOW,
@@ -29,48 +30,265 @@ enum TileResolution {
     HIGH
 };
 
+/**
+ * @brief A node to be rendered, either as a whole or only one quadrant of
+ *        it, in place of a child which is not resident yet.
+ */
+struct RenderItem {
+    static constexpr unsigned char WHOLE_NODE = 4;
+
+    TerrainNode* node;
+    unsigned char quadrant;
+};
+
+/**
+ * @brief Per node parameters of the multi-draw indirect path, laid out like
+ *        the std430 TileInstance struct in the *-mdi shaders.
+ */
+struct TileInstance {
+    glm::vec4 subRect;
+    glm::vec4 overlayRect;
+    glm::vec4 tile; /* Tile key (xy), zoom (z) and mesh side length (w) */
+    glm::ivec4 layers; /* Heightmap (x), overlay (y) and parent heightmap (z) texture pool layer */
+    glm::vec4 morph; /* Offset in the parent (xy), side length of the parent's mesh (z) and morph factor (w) */
+};
+
+/**
+ * @brief Per frame camera and lighting parameters, laid out like the std140
+ *        Globals uniform block of the terrain and pole shaders.
+ */
+struct GlobalUniforms {
+    static constexpr unsigned BINDING = 0;
+
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::mat4 model;
+    glm::vec3 cameraPos;
+    float fogDensity;
+    glm::vec3 lightDirection;
+    float doFog;
+    glm::vec3 skyColor;
+    float yScale;
+    float useWire;
+    float padding[3]; /* std140 rounds the block size up to a vec4 */
+};
+
+/**
+ * @brief Locations of the uniforms which are set per node on the regular
+ *        path, resolved once after the shader is linked.
+ */
+struct NodeUniforms {
+    int tileWidth, zoom, tileKey, subRect, overlayRect, heightmapLayer, overlayLayer, terrainColor, parentHeightmapLayer, morph;
+
+    static NodeUniforms resolve(const Shader& shader)
+    {
+        return { shader.uniformLocation("tileWidth"), shader.uniformLocation("zoom"),
+            shader.uniformLocation("tileKey"), shader.uniformLocation("subRect"),
+            shader.uniformLocation("overlayRect"), shader.uniformLocation("heightmapLayer"),
+            shader.uniformLocation("overlayLayer"), shader.uniformLocation("terrainColor"),
+            shader.uniformLocation("parentHeightmapLayer"), shader.uniformLocation("morph") };
+    }
+};
+
+/**
+ * @brief Layout of a glMultiDrawElementsIndirect command, as defined by
+ *        OpenGL.
+ */
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+/**
+ * @brief A texture upload from a staging slot of the texture pool, which
+ *        has not completed yet.
+ */
+struct PendingUpload {
+    TerrainNode* node;
+    LoadResponseLayer layer;
+    int slot;
+};
+
+/**
+ * @brief A subtree of the quadtree which is traversed by its own task.
+ *
+ * The offsets mark where the results of the subtree belong in the results of
+ * the traversal that forked it, so that merging keeps the serial order.
+ */
+struct TraversalFork {
+    TerrainNode* node;
+    bool insideFrustum;
+    unsigned planeMask;
+    std::size_t visibleOffset;
+    std::size_t requestOffset;
+    std::size_t skipLevelOffset;
+    std::size_t overlayOffset;
+    std::size_t touchOffset;
+};
+
+/**
+ * @brief Children of a node which should be requested, as a bit mask of
+ *        quadrants.
+ */
+struct ChildRequest {
+    TerrainNode* node;
+    unsigned quadrants;
+};
+
+/**
+ * @brief How far the camera may move before the output of a traversed
+ *        subtree could change. The motion is measured like for the culling
+ *        memos, as translation plus reach times the change of the front and
+ *        up vectors, see TerrainManager::cameraMotion.
+ */
+struct CutMargin {
+    float margin;
+    float reach; /* Largest distance of a culled box from the camera */
+};
+
+/**
+ * @brief Everything a traversal task produces.
+ *
+ * Tasks do not touch the caches or post requests themselves, since the
+ * caches and request queues are not shared between threads. Instead, the
+ * touches and requests are collected and applied on the render thread.
+ */
+struct TraversalContext {
+    static constexpr unsigned NO_FORK = ~0u;
+
+    std::vector<RenderItem> visibleNodes;
+    std::vector<ChildRequest> childRequests;
+    std::vector<XYZTileKey> skipLevelRequests; /* Tiles below the children, see collectSkipLevelRequests */
+    std::vector<TerrainNode*> overlayRequests; /* Nodes whose overlay failed to load */
+    std::vector<XYZTileKey> touchedKeys;
+    std::vector<TraversalFork> forks;
+
+    unsigned forkDepth = NO_FORK;
+    unsigned index = 0; /* 0 for the root traversal, i + 1 for fork i */
+    unsigned traversedNodes = 0;
+    unsigned reusedSubtrees = 0;
+    unsigned planeTestsSaved = 0;
+    unsigned memoizedDecisions = 0;
+    unsigned culledChildren = 0; /* Non resident children predicted invisible */
+
+    void clear()
+    {
+        visibleNodes.clear();
+        childRequests.clear();
+        skipLevelRequests.clear();
+        overlayRequests.clear();
+        touchedKeys.clear();
+        forks.clear();
+        traversedNodes = 0;
+        reusedSubtrees = 0;
+        planeTestsSaved = 0;
+        memoizedDecisions = 0;
+        culledChildren = 0;
+    }
+};
+
 /**
  * @brief The terrain manager manages a collection of terrain tiles.
  */
 class TerrainManager {
 public:
-    TerrainManager(RenderStatistics& stats, unsigned lowResMesh, unsigned mediumResMesh, unsigned highResMesh, unsigned memCacheSize, unsigned diskCacheSize);
+    TerrainManager(RenderStatistics& stats);
     void setup();
     void shutdown();
     void render(Camera& camera, bool wireframe, bool aabb, bool& collision, float& verticalCollisionOffset);
+    void updateGlobals(const GlobalUniforms& globals);
 
     // private:
     void initDiskCache();
-    void renderNode(Camera& camera, TerrainNode* node, TileResolution resolution, bool wireframe, bool aabb);
+    void renderNodes(bool wireframe);
+    void renderNodesTessellated(bool wireframe);
+    void computeTessellationBorders();
+    static float tessellationDetail(TerrainNode* node);
+    void beginInvocationQuery();
+    void endInvocationQuery();
+    void setNodeUniforms(const Shader& shader, const NodeUniforms& uniforms, const RenderItem& item, unsigned sideLength, bool wireframe);
+    void renderNodesIndirect();
+    void renderAabb(TerrainNode* node);
+    void setupMultiDrawIndirect();
+    TerrainNode* overlaySource(TerrainNode* node, glm::vec4& overlayRect);
+    glm::vec4 morphParameters(TerrainNode* node, int& parentLayer);
+    static TileResolution tileResolution(unsigned zoom);
+    static glm::vec4 quadrantRect(unsigned quadrant);
 
-    void collectRenderable(Camera& camera, XYZTileKey currentTileKey, std::queue<std::string>& visibleTiles, XYZTileKey& minimumDistanceTileKey, float& minimumDistance);
-    void requestChildren(XYZTileKey tileKey);
-    void updateMinimumDistanceTileKey(Camera& camera, XYZTileKey currentTileKey, XYZTileKey& minimumDistanceTileKey, float& minimumDistance);
+    void traverse(Camera& camera);
+    CutMargin collectRenderable(Camera& camera, TerrainNode* currentNode, bool insideFrustum, unsigned planeMask, TraversalContext& context);
+    CutMargin evaluateNode(Camera& camera, TerrainNode* currentNode, bool insideFrustum, unsigned planeMask, TraversalContext& context);
+    bool reuseSubtree(Camera& camera, TerrainNode* node, bool insideFrustum, unsigned planeMask, TraversalContext& context, CutMargin& margin);
+    void invalidateCut(TerrainNode* node);
+    void mergeTraversal();
+    void requestChildren(TerrainNode* node, unsigned quadrants);
+    void collectSkipLevelRequests(Camera& camera, TerrainNode* node, TraversalContext& context);
+    XYZTileKey findMinimumDistanceTileKey(Camera& camera);
     bool checkCollision(Camera& camera, XYZTileKey minimumDistanceTileKey, float& verticalCollisionOffset);
 
-    bool allChildrenExistant(XYZTileKey tileKey);
-    bool shouldSplit(Camera& camera, XYZTileKey currentTileKey);
+    bool shouldSplit(Camera& camera, TerrainNode* tile, TraversalContext& context);
+    unsigned cullChildren(Camera& camera, TerrainNode* node, unsigned planeMask, unsigned childPlaneMasks[4], TraversalContext& context);
+    bool updateLodGeneration(Camera& camera);
+    static float cameraMotion(Camera& camera, const glm::vec3& position, const glm::vec3& front, const glm::vec3& up, float reach);
     bool hasChildren(XYZTileKey tileKey);
 
     void processSingleDoneQueueElement();
     void processAllDoneQueue();
+    void integrateResponse(LoadResponse& response);
+    unsigned requestPriority(XYZTileKey tileKey) const;
     void processAllUnloadDoneQueue();
-
-    float computeBaseDistWithLatitude(XYZTileKey tileKey);
+    void processPendingUploads();
 
     void initTerrainNode(LoadResponse response);
-    void requestNode(XYZTileKey tileKey);
+    bool makeRoomForNode(XYZTileKey tileKey);
+    void initOverlay(TerrainNode* node, LoadResponse& response);
+    void processOverlayResponse(LoadResponse& response);
+    void indexDiskCache(XYZTileKey tileKey);
+    void discardHeightmap(XYZTileKey tileKey);
+    bool requestNode(XYZTileKey tileKey);
+    void requestOverlay(TerrainNode* node);
 
     void loadHeightmapTexture();
     void loadOverlayTexture();
 
     bool checkEviction(XYZTileKey tileKey, TerrainNode* tile);
+    void linkNode(TerrainNode* node);
+    void unlinkNode(TerrainNode* node);
+    void setChildState(XYZTileKey tileKey, TerrainNode::ChildState state);
 
     std::unordered_set<XYZTileKey> _loadingTiles;
 
-    LRUCache<XYZTileKey, TerrainNode*> _memoryCache;
-    LRUCache<XYZTileKey, void*> _diskCache; /* Key only LRU cache for tiles
-                                             * on disk */
+    std::vector<RenderItem> _visibleNodes;
+    std::vector<RenderItem> _renderQueues[3]; /* Visible nodes per resolution */
+
+    /* Parallel traversal, the pool is only created if enabled in the config.
+     * The contexts are kept as members so that their storage is reused. */
+    TaskPool* _traversalPool = nullptr;
+    unsigned _traversalForkDepth;
+    TraversalContext _traversal;
+    std::vector<TraversalContext> _forkContexts;
+
+    /* The contexts of the last traversal, which hold the output of the
+     * subtrees that are reused, see collectRenderable */
+    TraversalContext _previousTraversal;
+    std::vector<TraversalContext> _previousForkContexts;
+    unsigned _traversalCount = 1;
+
+    /* Texture array layers leased by the nodes in the memory cache */
+    TexturePool* _texturePool = nullptr;
+    std::vector<PendingUpload> _pendingUploads;
+
+    /* Loaded tiles which have not been integrated yet, since integrating
+     * is limited by a time budget per frame, 0 is unlimited */
+    std::vector<LoadResponse> _integrationBacklog;
+    long long _integrationBudgetMicros;
+
+    FlatLRUCache<XYZTileKey, TerrainNode*> _memoryCache;
+    FlatLRUCache<XYZTileKey, void*> _diskCache; /* Key only LRU cache for tiles
+                                                 * on disk */
 
     /* ============================= Threading ============================= */
     unsigned _numLoadWorkers;
@@ -95,20 +313,49 @@ public:
      * waste unneccessary requests if a tile cannot be loaded anyway. */
     std::unordered_set<XYZTileKey> _unloadableTileKeys;
 
-    TerrainNode* _root;
+    TerrainNode* _root = nullptr;
+
+    /* ======================= Multi-draw indirect ========================= */
+    /* Only used if enabled in the config and supported by the context. All
+     * visible nodes of a resolution are drawn with one call per mesh, the
+     * draw IDs are an instanced attribute offset by the base instance. */
+    bool _multiDrawIndirect = false;
+    unsigned _instanceBuffer, _indirectBuffer, _drawIdBuffer;
+    unsigned _drawIdCapacity = 0;
+    std::vector<TileInstance> _tileInstances[3]; /* Per resolution */
+    std::vector<TileInstance> _instanceUpload;
+    std::vector<DrawElementsIndirectCommand> _indirectCommands;
+
+    /* Vertex shader invocations of the terrain, only counted if
+     * ARB_pipeline_statistics_query is available */
+    static constexpr unsigned INVOCATION_QUERIES = 3;
+    bool _pipelineStatistics = false;
+    unsigned _invocationQueries[INVOCATION_QUERIES];
+    bool _invocationQueryIssued[INVOCATION_QUERIES] = {};
+    unsigned _invocationQueryFrame = 0;
+
+    /* Tessellation, disabled if the target edge length in pixels is 0 */
+    unsigned _tessellationEdgeLength;
+    Shader _tessellationShader;
+    NodeUniforms _tessellationUniforms;
+    int _detailLocation, _tessellationScaleLocation, _borderCoarserLocation, _borderMinExponentLocation;
+    PatchMesh* _patchMesh = nullptr;
+
+    /* Per visible node, see computeTessellationBorders */
+    std::unordered_map<XYZTileKey, unsigned> _tessellationPieces;
+    std::vector<glm::vec4> _borderCoarser, _borderMinExponent;
 
     /* ======================== Meshes and shaders ========================= */
     Shader _terrainShader;
-    Shader _skirtShader;
     Shader _poleShader;
     Shader _aabbShader;
+    NodeUniforms _terrainUniforms;
+    int _isNorthPoleLocation;
+    unsigned _globalsBuffer; /* Uniform buffer of the Globals block */
 
     GridMesh* _gridMeshLow;
     GridMesh* _gridMeshMedium;
     GridMesh* _gridMeshHigh;
-    SkirtMesh* _skirtMeshLow;
-    SkirtMesh* _skirtMeshMedium;
-    SkirtMesh* _skirtMeshHigh;
     AABBMesh* _aabbMesh;
 
     PoleMesh* _poleMesh;
@@ -119,6 +366,32 @@ public:
 
     float _timeToLiveMillis = 1000.0f * 5;
 
+    /* Screen space error LOD */
+    float _pixelTolerance;
+    float _screenSpaceErrorFactor = 1.0f; /* Updated each frame from the camera */
+    float _morphRange; /* Fraction of the parent's split distance, 0 disables geomorphing */
+
+    /* Computed once per traversal */
+    const HorizonCullingCamera* _horizonCullingCamera = nullptr;
+    glm::vec3 _cameraPosition = glm::vec3(0.0f);
+    glm::vec2 _cameraMercator;
+
+    /* Skip-level loading, disabled if 0 */
+    unsigned _skipLevelStride;
+
+    /* Temporal coherence of the LOD cut. Memoized decisions on the nodes
+     * are only valid for the current generation. The tree version changes
+     * whenever loading or eviction changed the cut, see invalidateCut. */
+    unsigned _lodGeneration = 1;
+    unsigned _treeVersion = 0;
+    unsigned _lastTreeVersion = 0;
+    float _lastPixelTolerance = 0.0f;
+    float _lastAspectRatio = 0.0f;
+    glm::vec3 _lastCameraPosition = glm::vec3(0.0f);
+    glm::vec3 _lastCameraFront = glm::vec3(0.0f);
+    glm::vec3 _lastCameraUp = glm::vec3(0.0f);
+    XYZTileKey _lastMinimumDistanceTileKey;
+
     unsigned _tileSideLengthHighRes, _tileSideLengthLowRes, _tileSideLengthMediumRes;
     unsigned _heightmapWidth, _heightmapHeight;
     unsigned _overlayWidth, _overlayHeight;
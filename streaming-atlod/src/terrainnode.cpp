@@ -5,7 +5,10 @@
 
 #include "globalconstants.h"
 #include "mapprojections.h"
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
+#include <glm/gtc/constants.hpp>
 #include <iostream>
 #include <limits>
 #include <webp/decode.h>
@@ -20,8 +23,15 @@ TerrainNode::TerrainNode(XYZTileKey tileKey)
     , _minHeight(std::numeric_limits<float>::max())
     , _maxHeight(std::numeric_limits<float>::lowest())
 {
-    _projectedGridPoints.reserve(9);
-    _horizonCullingPoints.reserve(9);
+}
+
+/**
+ * @brief TerrainNode::hasResidentChildren
+ * @return
+ */
+bool TerrainNode::hasResidentChildren() const
+{
+    return _children[0] || _children[1] || _children[2] || _children[3];
 }
 
 /**
@@ -63,75 +73,245 @@ float TerrainNode::getScaledHeight(unsigned x, unsigned y)
     return (-10000.0f + ((height.x * 256.0f * 256.0f + height.y * 256.0f + height.z) * 0.1f)) * GlobalConstants::HEIGHT_SCALE;
 }
 
+/**
+ * @brief TerrainNode::sampleScaledHeight
+ * @param u Horizontal texture coordinate in [0, 1]
+ * @param v Vertical texture coordinate in [0, 1]
+ * @return Height of the nearest texel
+ */
+float TerrainNode::sampleScaledHeight(float u, float v)
+{
+    return getScaledHeight((unsigned)std::round(u * 511.0f), (unsigned)std::round(v * 511.0f));
+}
+
 /**
  * @brief TerrainNode::horizonCulled
+ *
+ * Tests the horizon occlusion point against the ellipsoid in the scaled
+ * space, where the ellipsoid is the unit sphere. The camera terms only
+ * depend on the camera and are computed once per frame, see
+ * HorizonCullingCamera.
+ *
+ * @param camera
+ * @return
+ */
+bool TerrainNode::horizonCulled(const HorizonCullingCamera& camera) const
+{
+    return _hasHorizonOcclusionPoint && horizonOccluded(_horizonOcclusionPoint, camera);
+}
+
+/**
+ * @brief TerrainNode::childHorizonCulled Horizon culling with the predicted
+ *                                        occlusion point of a child
+ * @param quadrant
+ * @param camera
+ * @return
+ */
+bool TerrainNode::childHorizonCulled(unsigned quadrant, const HorizonCullingCamera& camera) const
+{
+    const ChildPrediction& prediction = _childPredictions[quadrant];
+    return prediction.hasHorizonOcclusionPoint && horizonOccluded(prediction.horizonOcclusionPoint, camera);
+}
+
+/**
+ * @brief TerrainNode::horizonOccluded
+ * @param point Horizon occlusion point in the scaled space
  * @param camera
  * @return
  */
-bool TerrainNode::horizonCulled(Camera& camera)
+bool TerrainNode::horizonOccluded(const glm::vec3& point, const HorizonCullingCamera& camera)
+{
+    glm::vec3 vt = point - camera.scaledPosition;
+    float vtDotVc = -glm::dot(vt, camera.scaledPosition);
+
+    /* Camera is inside the ellipsoid */
+    if (camera.horizonDistanceSquared < 0.0f)
+        return vtDotVc > 0.0f;
+
+    return vtDotVc > camera.horizonDistanceSquared
+        && vtDotVc * vtDotVc > camera.horizonDistanceSquared * glm::dot(vt, vt);
+}
+
+/**
+ * @brief HorizonCullingCamera::HorizonCullingCamera
+ * @param cameraPosition
+ */
+HorizonCullingCamera::HorizonCullingCamera(glm::vec3 cameraPosition)
+    : scaledPosition(cameraPosition / GlobalConstants::GLOBE_RADII)
+    , horizonDistanceSquared(glm::dot(scaledPosition, scaledPosition) - 1.0f)
+{
+}
+
+/**
+ * @brief TerrainNode::generateGeometricError
+ *
+ * Estimates how far the mesh used for this node deviates from the mesh of
+ * the next finer level. The children cover the node with twice as many
+ * vertices per side, so the node mesh is compared against a grid with twice
+ * the resolution sampled from the same heightmap. Since the mesh is projected
+ * onto the globe per vertex, the sagitta of a single quad (flat chord versus
+ * curved surface) is taken into account as well, which dominates at low zoom
+ * levels.
+ *
+ * @param meshResolution Number of vertices per side of the node's mesh
+ */
+void TerrainNode::generateGeometricError(unsigned meshResolution)
 {
-    glm::vec3 cv = glm::vec3(camera.position()) / GlobalConstants::GLOBE_RADII;
+    unsigned coarse = meshResolution - 1; /* Quads per side */
+    unsigned fine = 2 * coarse;
+
+    std::vector<float> coarseHeights((coarse + 1) * (coarse + 1));
+    for (unsigned j = 0; j <= coarse; j++) {
+        for (unsigned i = 0; i <= coarse; i++) {
+            coarseHeights[j * (coarse + 1) + i] = sampleScaledHeight((float)i / coarse, (float)j / coarse);
+        }
+    }
+
+    float heightError = 0.0f;
+    for (unsigned j = 0; j <= fine; j++) {
+        for (unsigned i = 0; i <= fine; i++) {
+            /* Vertices shared with the coarse mesh have no error */
+            if (i % 2 == 0 && j % 2 == 0)
+                continue;
 
-    double vhMagnitudeSquared = glm::dot(cv, cv) - 1.0;
+            unsigned ci = std::min(i / 2, coarse - 1);
+            unsigned cj = std::min(j / 2, coarse - 1);
+            float fu = i * 0.5f - ci;
+            float fv = j * 0.5f - cj;
 
-    for (auto p : _horizonCullingPoints) {
-        glm::vec3 t = p / GlobalConstants::GLOBE_RADII;
-        glm::vec3 vt = t - cv;
-        float vtMagnitudeSquared = glm::dot(vt, vt);
-        float vtDotVc = -1.0f * glm::dot(vt, cv);
-        bool isOccluded = vtDotVc > vhMagnitudeSquared && vtDotVc * vtDotVc / vtMagnitudeSquared > vhMagnitudeSquared;
+            float h00 = coarseHeights[cj * (coarse + 1) + ci];
+            float h10 = coarseHeights[cj * (coarse + 1) + ci + 1];
+            float h01 = coarseHeights[(cj + 1) * (coarse + 1) + ci];
+            float h11 = coarseHeights[(cj + 1) * (coarse + 1) + ci + 1];
+            float interpolated = glm::mix(glm::mix(h00, h10, fu), glm::mix(h01, h11, fu), fv);
 
-        if (!isOccluded)
-            return false;
+            float exact = sampleScaledHeight((float)i / fine, (float)j / fine);
+            heightError = std::max(heightError, std::abs(exact - interpolated));
+        }
     }
 
-    return true;
+    /* Angle spanned by one quad along the equator, which is the widest */
+    float quadAngle = glm::two_pi<float>() / (float)(1 << _xyzTileKey.z()) / coarse;
+    float sagitta = GlobalConstants::GLOBE_RADII.x * (1.0f - std::cos(quadAngle / 2.0f));
+
+    _geometricError = std::max(heightError, sagitta);
 }
 
 /**
- * @brief TerrainNode::generateProjectedGridPoints
+ * @brief TerrainNode::generateHorizonOcclusionPoint
  *
- * The grid points are laid out as follows before being projected to the WGS84
- * ellipsoid:
+ * Computes a single point in the scaled space which is below the horizon
+ * only if all of the tile is, as described by Cesium ("Horizon Culling 2").
+ * The point lies on the ray from the center of the ellipsoid through the
+ * tile center. For every sample point of the tile at its maximum height,
+ * the distance along that ray is computed at which the point and the
+ * sample share the same horizon, and the farthest one is taken.
  *
- * * - - - * - - - *
- * |               |
- * |               |
- * |               |
- * *       *       *
- * |               |
- * |               |
- * |               |
- * * - - - * - - - *
- */
-void TerrainNode::generateProjectedGridPoints()
-{
-    float pow2Level = (float)(1 << _xyzTileKey.z());
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            glm::vec2 pTemp = MapProjections::inverseWebMercator(glm::vec2(_xyzTileKey.x() + i * 0.5f, _xyzTileKey.y() + j * 0.5f) / pow2Level);
-            unsigned coordX = glm::floor(i * (511.0 / 3.0));
-            unsigned coordY = glm::floor(j * (511.0 / 3.0));
-            float height = getScaledHeight(coordX, coordY);
-            glm::vec3 spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(pTemp.x, height, pTemp.y));
+ * If a sample is too far off the ray, no such point exists and the node is
+ * never horizon culled, which only happens for the large tiles of the
+ * lowest levels.
+ */
+void TerrainNode::generateHorizonOcclusionPoint()
+{
+    _hasHorizonOcclusionPoint = computeHorizonOcclusionPoint(_xyzTileKey, _maxHeight, _horizonOcclusionPoint);
+}
+
+/**
+ * @brief TerrainNode::computeHorizonOcclusionPoint
+ * @param tileKey
+ * @param maxHeight
+ * @param point
+ * @return Whether an occlusion point exists for the tile
+ */
+bool TerrainNode::computeHorizonOcclusionPoint(XYZTileKey tileKey, float maxHeight, glm::vec3& point)
+{
+    const int samples = 5;
+    float pow2Level = (float)(1 << tileKey.z());
+
+    glm::vec2 center = MapProjections::inverseWebMercator(glm::vec2(tileKey.x() + 0.5f, tileKey.y() + 0.5f) / pow2Level);
+    glm::vec3 centerPos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(center.x, 0.0f, center.y));
+    glm::vec3 direction = glm::normalize(centerPos / GlobalConstants::GLOBE_RADII);
+
+    float maxMagnitude = 0.0f;
 
-            _projectedGridPoints.push_back(spherePos);
+    for (int i = 0; i < samples; i++) {
+        for (int j = 0; j < samples; j++) {
+            glm::vec2 uv = glm::vec2(tileKey.x() + i / (samples - 1.0f), tileKey.y() + j / (samples - 1.0f)) / pow2Level;
+            glm::vec2 pTemp = MapProjections::inverseWebMercator(uv);
+            glm::vec3 spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(pTemp.x, maxHeight + 6.5f, pTemp.y));
+            glm::vec3 scaled = spherePos / GlobalConstants::GLOBE_RADII;
+
+            float magnitudeSquared = std::max(1.0f, glm::dot(scaled, scaled));
+            float magnitude = std::sqrt(magnitudeSquared);
+            glm::vec3 scaledDirection = glm::normalize(scaled);
+
+            float cosAlpha = glm::dot(scaledDirection, direction);
+            float sinAlpha = glm::length(glm::cross(scaledDirection, direction));
+            float cosBeta = 1.0f / magnitude;
+            float sinBeta = std::sqrt(magnitudeSquared - 1.0f) * cosBeta;
+
+            float denominator = cosAlpha * cosBeta - sinAlpha * sinBeta;
+            if (denominator <= 0.0f)
+                return false;
+
+            maxMagnitude = std::max(maxMagnitude, 1.0f / denominator);
         }
     }
+
+    point = direction * maxMagnitude;
+    return true;
 }
 
 /**
- * @brief TerrainNode::generateHorizonPoints
+ * @brief TerrainNode::generateChildPredictions
+ *
+ * Predicts the bounds of the four children from the quadrants of this
+ * node's heightmap, so that children can be culled before they are
+ * requested. The children's heightmaps have twice the resolution, so their
+ * heights can exceed the ones of this node between texels. The height range
+ * of each quadrant is therefore padded by the largest height difference of
+ * neighbouring texels inside it.
+ *
+ * The predicted bounds are also put into _childBounds, until the children
+ * become resident.
  */
-void TerrainNode::generateHorizonPoints()
+void TerrainNode::generateChildPredictions()
 {
-    float pow2Level = (float)(1 << _xyzTileKey.z());
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            glm::vec2 pTemp = MapProjections::inverseWebMercator(glm::vec2(_xyzTileKey.x() + i * 0.5f, _xyzTileKey.y() + j * 0.5f) / pow2Level);
-            glm::vec3 spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(pTemp.x, _maxHeight + 6.5f, pTemp.y));
-            _horizonCullingPoints.push_back(spherePos);
+    for (unsigned q = 0; q < 4; q++) {
+        unsigned beginX = (q & 1) * 256, beginY = (q >> 1) * 256;
+
+        float minHeight = std::numeric_limits<float>::max();
+        float maxHeight = std::numeric_limits<float>::lowest();
+        float maxStep = 0.0f;
+
+        /* Include the texels bordering the quadrant */
+        unsigned endX = std::min(beginX + 257u, 512u), endY = std::min(beginY + 257u, 512u);
+        beginX = beginX > 0 ? beginX - 1 : 0;
+        beginY = beginY > 0 ? beginY - 1 : 0;
+
+        for (unsigned j = beginY; j < endY; j++) {
+            for (unsigned i = beginX; i < endX; i++) {
+                float height = getScaledHeight(i, j);
+                minHeight = std::min(minHeight, height);
+                maxHeight = std::max(maxHeight, height);
+
+                if (i + 1 < endX)
+                    maxStep = std::max(maxStep, std::abs(getScaledHeight(i + 1, j) - height));
+                if (j + 1 < endY)
+                    maxStep = std::max(maxStep, std::abs(getScaledHeight(i, j + 1) - height));
+            }
         }
+
+        minHeight -= maxStep;
+        maxHeight += maxStep;
+
+        XYZTileKey childKey = _xyzTileKey.child(q);
+        ChildPrediction& prediction = _childPredictions[q];
+
+        computeAabb(childKey, minHeight, maxHeight, prediction.aabbP1, prediction.aabbP2);
+        prediction.hasHorizonOcclusionPoint = computeHorizonOcclusionPoint(childKey, maxHeight, prediction.horizonOcclusionPoint);
+
+        _childBounds.set(q, prediction.aabbP1, prediction.aabbP2);
     }
 }
 
@@ -146,41 +326,56 @@ void TerrainNode::generateAabb()
         generateAabbZoom0();
     else if (zoom == 1)
         generateAabbZoom1();
-    else {
-        float maxX = std::numeric_limits<float>::lowest(),
-              maxY = std::numeric_limits<float>::lowest(),
-              maxZ = std::numeric_limits<float>::lowest();
-
-        float minX = std::numeric_limits<float>::max(),
-              minY = std::numeric_limits<float>::max(),
-              minZ = std::numeric_limits<float>::max();
-
-        float pow2Level = (1 << zoom);
-
-        for (int i = 0; i < 3; i++) {
-            for (int j = 0; j < 3; j++) {
-                glm::vec2 lonLat = MapProjections::inverseWebMercator(glm::vec2((float)_xyzTileKey.x() + (float)i * 0.5f, (float)_xyzTileKey.y() + (float)j * 0.5f) / pow2Level);
-                glm::vec3 spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(lonLat.x, _minHeight, lonLat.y));
-                maxX = std::max(maxX, spherePos.x);
-                maxY = std::max(maxY, spherePos.y);
-                maxZ = std::max(maxZ, spherePos.z);
-                minX = std::min(minX, spherePos.x);
-                minY = std::min(minY, spherePos.y);
-                minZ = std::min(minZ, spherePos.z);
-
-                spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(lonLat.x, _maxHeight, lonLat.y));
-                maxX = std::max(maxX, spherePos.x);
-                maxY = std::max(maxY, spherePos.y);
-                maxZ = std::max(maxZ, spherePos.z);
-                minX = std::min(minX, spherePos.x);
-                minY = std::min(minY, spherePos.y);
-                minZ = std::min(minZ, spherePos.z);
-            }
-        }
+    else
+        computeAabb(_xyzTileKey, _minHeight, _maxHeight, _aabbP1, _aabbP2);
+}
 
-        _aabbP1 = glm::vec3(minX, minY, minZ);
-        _aabbP2 = glm::vec3(maxX, maxY, maxZ);
+/**
+ * @brief TerrainNode::computeAabb Bounding box of a tile from level 2
+ *                                 upwards with the given height range
+ * @param tileKey
+ * @param minHeight
+ * @param maxHeight
+ * @param aabbP1
+ * @param aabbP2
+ */
+void TerrainNode::computeAabb(XYZTileKey tileKey, float minHeight, float maxHeight, glm::vec3& aabbP1, glm::vec3& aabbP2)
+{
+    unsigned zoom = tileKey.z();
+
+    float maxX = std::numeric_limits<float>::lowest(),
+          maxY = std::numeric_limits<float>::lowest(),
+          maxZ = std::numeric_limits<float>::lowest();
+
+    float minX = std::numeric_limits<float>::max(),
+          minY = std::numeric_limits<float>::max(),
+          minZ = std::numeric_limits<float>::max();
+
+    float pow2Level = (1 << zoom);
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            glm::vec2 lonLat = MapProjections::inverseWebMercator(glm::vec2((float)tileKey.x() + (float)i * 0.5f, (float)tileKey.y() + (float)j * 0.5f) / pow2Level);
+            glm::vec3 spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(lonLat.x, minHeight, lonLat.y));
+            maxX = std::max(maxX, spherePos.x);
+            maxY = std::max(maxY, spherePos.y);
+            maxZ = std::max(maxZ, spherePos.z);
+            minX = std::min(minX, spherePos.x);
+            minY = std::min(minY, spherePos.y);
+            minZ = std::min(minZ, spherePos.z);
+
+            spherePos = MapProjections::geodeticToCartesian(GlobalConstants::GLOBE_RADII_SQUARED, glm::vec3(lonLat.x, maxHeight, lonLat.y));
+            maxX = std::max(maxX, spherePos.x);
+            maxY = std::max(maxY, spherePos.y);
+            maxZ = std::max(maxZ, spherePos.z);
+            minX = std::min(minX, spherePos.x);
+            minY = std::min(minY, spherePos.y);
+            minZ = std::min(minZ, spherePos.z);
+        }
     }
+
+    aabbP1 = glm::vec3(minX, minY, minZ);
+    aabbP2 = glm::vec3(maxX, maxY, maxZ);
 }
 
 /**
@@ -2,6 +2,7 @@
 #define TERRAINODE_H
 
 #include "camera.h"
+#include "frustumculling.h"
 
 #include "xyztilekey.h"
 #include <chrono>
@@ -12,6 +13,19 @@
 
 class TerrainManager;
 
+/**
+ * @brief Camera terms of the horizon culling test, which are the same for
+ *        all nodes in a frame
+ */
+struct HorizonCullingCamera {
+    HorizonCullingCamera(glm::vec3 cameraPosition);
+
+    glm::vec3 scaledPosition; /* Camera position in the ellipsoid scaled space */
+    float horizonDistanceSquared; /* Squared distance to the horizon in the
+                                   * scaled space, negative if the camera is
+                                   * inside the ellipsoid */
+};
+
 /**
  * @brief
  */
@@ -29,9 +43,18 @@ public:
                           e.g. a 204 return code */
     };
 
+    /* State of a child slot as seen from its parent */
+    enum ChildState {
+        CHILD_ABSENT, /* Not in the memory cache and not requested */
+        CHILD_LOADING, /* Requested from a load worker */
+        CHILD_RESIDENT, /* In the memory cache, pointer is set */
+        CHILD_UNLOADABLE /* The APIs do not serve this tile */
+    };
+
     // TerrainTile(glm::vec3 worldSpaceCenterPos, TerrainManager* manager, unsigned zoom, std::pair<unsigned, unsigned> tileKey, TerrainTile* parent);
     TerrainNode(XYZTileKey tileKey);
-    bool horizonCulled(Camera& camera);
+    bool horizonCulled(const HorizonCullingCamera& camera) const;
+    bool childHorizonCulled(unsigned quadrant, const HorizonCullingCamera& camera) const;
     void generateMinMaxHeight();
 
     // private:
@@ -39,16 +62,78 @@ public:
     void generateAabb();
     void generateAabbZoom0();
     void generateAabbZoom1();
-    void generateProjectedGridPoints();
-    void generateHorizonPoints();
+    void generateGeometricError(unsigned meshResolution);
+    void generateHorizonOcclusionPoint();
+    void generateChildPredictions();
+
+    static void computeAabb(XYZTileKey tileKey, float minHeight, float maxHeight, glm::vec3& aabbP1, glm::vec3& aabbP2);
+    static bool computeHorizonOcclusionPoint(XYZTileKey tileKey, float maxHeight, glm::vec3& point);
+    static bool horizonOccluded(const glm::vec3& point, const HorizonCullingCamera& camera);
 
     glm::vec3 getHeight(unsigned x, unsigned y);
 
     float getScaledHeight(unsigned x, unsigned y);
+    float sampleScaledHeight(float u, float v);
+
+    bool hasResidentChildren() const;
 
     std::chrono::system_clock::time_point _lastUsedTimeStamp;
 
     XYZTileKey _xyzTileKey;
+
+    /* Links of the quadtree of resident nodes, children are indexed by
+     * XYZTileKey::quadrant() */
+    TerrainNode* _parent = nullptr;
+    TerrainNode* _children[4] = { nullptr, nullptr, nullptr, nullptr };
+    ChildState _childStates[4] = { CHILD_ABSENT, CHILD_ABSENT, CHILD_ABSENT, CHILD_ABSENT };
+
+    /* Bounding boxes of the children, for culling them at once. Holds the
+     * predicted bounds for children which are not resident. */
+    AABBBatch _childBounds;
+
+    /* Conservative bounds of the children, predicted from this node's
+     * heightmap by the load worker, see generateChildPredictions */
+    struct ChildPrediction {
+        glm::vec3 aabbP1, aabbP2;
+        glm::vec3 horizonOcclusionPoint;
+        bool hasHorizonOcclusionPoint = false;
+    };
+    ChildPrediction _childPredictions[4];
+
+    /* Frustum plane which last rejected one of the children, tested first
+     * in the next frame */
+    unsigned char _lastRejectingPlane = 0;
+
+    /* Memoized LOD decisions of the last evaluation, valid as long as the
+     * generation matches and the camera moved less than the margin, see
+     * TerrainManager::shouldSplit and TerrainManager::cullChildren */
+    unsigned _splitMemoGeneration = 0;
+    bool _splitMemo;
+    float _splitMemoMargin;
+    glm::vec3 _splitMemoPosition;
+
+    unsigned _cullMemoGeneration = 0;
+    unsigned _cullMemoPlaneMask;
+    unsigned _cullMemoVisible;
+    unsigned _cullMemoChildPlaneMasks[4];
+    float _cullMemoSlack;
+    float _cullMemoReach; /* Distance to the farthest point of the children */
+    glm::vec3 _cullMemoPosition, _cullMemoFront, _cullMemoUp;
+
+    /* Output of the last traversal of this subtree, as ranges into the
+     * traversal context which produced it. Reused instead of traversing
+     * the subtree while the camera moved less than the margin, see
+     * TerrainManager::collectRenderable */
+    unsigned _cutMemoTraversal = 0;
+    unsigned _cutMemoGeneration;
+    unsigned _cutMemoContext;
+    bool _cutMemoInsideFrustum;
+    unsigned _cutMemoPlaneMask;
+    std::size_t _cutMemoVisibleBegin, _cutMemoVisibleEnd;
+    std::size_t _cutMemoTouchBegin, _cutMemoTouchEnd;
+    float _cutMemoMargin;
+    float _cutMemoReach;
+    glm::vec3 _cutMemoPosition, _cutMemoFront, _cutMemoUp;
     glm::vec3 _wgs86CenterPos;
 
     glm::vec3 _aabbP1, _aabbP2;
@@ -57,12 +142,24 @@ public:
 
     float _minHeight, _maxHeight;
 
-    std::vector<glm::vec3> _projectedGridPoints;
-    std::vector<glm::vec3> _horizonCullingPoints;
+    /* Maximum deviation of this node's mesh from the next finer level, in
+     * world units */
+    float _geometricError = 0.0f;
+
+    /* Horizon occlusion point in the ellipsoid scaled space, see
+     * generateHorizonOcclusionPoint */
+    glm::vec3 _horizonOcclusionPoint;
+    bool _hasHorizonOcclusionPoint = false;
 
     unsigned char *_heightData, _textureData;
 
-    unsigned _overlayTextureId, _heightmapTextureId; /* For OpenGL texture objects */
+    /* The heights of a resident node are always on the GPU, the overlay
+     * may still be loading. Until it is GPU_READY, the overlay of the
+     * nearest ancestor which has one is used. */
+    TileState _overlayState = DOWNLOADABLE;
+
+    int _textureLayer = -1; /* Layer of the heightmap and overlay in the texture pool */
+    TileState _heightState = GPU_READY; /* LOADING_FROM_MEMORY while the upload is in flight */
 };
 
 #endif // TERRAINNODE_H
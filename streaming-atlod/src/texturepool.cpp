@@ -0,0 +1,333 @@
+#include "texturepool.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "util.h"
+
+/**
+ * @brief TexturePool::TexturePool
+ * @param capacity Number of layers
+ */
+TexturePool::TexturePool(unsigned capacity)
+{
+    _capacity = capacity;
+}
+
+/**
+ * @brief TexturePool::load Allocates the texture arrays
+ */
+void TexturePool::load()
+{
+    GLint maxLayers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+    if (_capacity > (unsigned)maxLayers) {
+        std::cerr << "Texture pool needs " << _capacity << " layers, but only " << maxLayers << " are supported" << std::endl;
+        std::exit(1);
+    }
+
+    glGenTextures(1, &_heightmapArrayId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _heightmapArrayId);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, LAYER_SIZE, LAYER_SIZE, _capacity, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+
+    Util::checkGlError("HEIGHTMAP ARRAY ALLOCATION FAILED");
+
+    glGenTextures(1, &_overlayArrayId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _overlayArrayId);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, numberOfMipmapLevels() - 1);
+
+    unsigned size = LAYER_SIZE;
+    for (unsigned level = 0; level < numberOfMipmapLevels(); level++) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, size, size, _capacity, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        size /= 2;
+    }
+
+    Util::checkGlError("OVERLAY ARRAY ALLOCATION FAILED");
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    /* Hand out the lowest layers first */
+    _freeLayers.reserve(_capacity);
+    for (int layer = _capacity - 1; layer >= 0; layer--)
+        _freeLayers.push_back(layer);
+
+    /* A slot holds the largest upload, which is an overlay with its mip
+     * levels */
+    _stagingSlotSize = LAYER_SIZE * LAYER_SIZE * 3 + mipmapsSize();
+    _persistentMapping = GLEW_ARB_buffer_storage;
+
+    glGenBuffers(STAGING_SLOTS, _stagingBuffers);
+
+    for (unsigned slot = 0; slot < STAGING_SLOTS; slot++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _stagingBuffers[slot]);
+
+        if (_persistentMapping) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, _stagingSlotSize, nullptr, flags);
+            _stagingPointers[slot] = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _stagingSlotSize, flags);
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, _stagingSlotSize, nullptr, GL_STREAM_DRAW);
+        }
+
+        _freeStagingSlots.push_back(slot);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    Util::checkGlError("STAGING BUFFER ALLOCATION FAILED");
+}
+
+/**
+ * @brief TexturePool::unload
+ */
+void TexturePool::unload()
+{
+    glDeleteTextures(1, &_heightmapArrayId);
+    glDeleteTextures(1, &_overlayArrayId);
+    _freeLayers.clear();
+
+    for (unsigned slot = 0; slot < STAGING_SLOTS; slot++) {
+        if (_stagingFences[slot])
+            glDeleteSync(_stagingFences[slot]);
+        _stagingFences[slot] = nullptr;
+    }
+
+    glDeleteBuffers(STAGING_SLOTS, _stagingBuffers);
+    _freeStagingSlots.clear();
+}
+
+/**
+ * @brief TexturePool::acquire
+ * @return A free layer, or -1 if all layers are leased
+ */
+int TexturePool::acquire()
+{
+    if (_freeLayers.empty())
+        return -1;
+
+    int layer = _freeLayers.back();
+    _freeLayers.pop_back();
+    return layer;
+}
+
+/**
+ * @brief TexturePool::release
+ * @param layer
+ */
+void TexturePool::release(int layer)
+{
+    if (layer >= 0)
+        _freeLayers.push_back(layer);
+}
+
+/**
+ * @brief TexturePool::acquireStagingSlot
+ * @return A free staging slot, or -1 if all slots have uploads in flight
+ */
+int TexturePool::acquireStagingSlot()
+{
+    if (_freeStagingSlots.empty())
+        return -1;
+
+    int slot = _freeStagingSlots.back();
+    _freeStagingSlots.pop_back();
+    return slot;
+}
+
+/**
+ * @brief TexturePool::stagingSlotDone
+ * @param slot
+ * @return Whether the upload issued from the slot has completed, without
+ *         waiting for it
+ */
+bool TexturePool::stagingSlotDone(int slot)
+{
+    GLsync fence = _stagingFences[slot];
+    if (!fence)
+        return true;
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+/**
+ * @brief TexturePool::releaseStagingSlot Returns a slot whose upload has
+ *                                        completed or was never issued
+ * @param slot
+ */
+void TexturePool::releaseStagingSlot(int slot)
+{
+    if (slot < 0)
+        return;
+
+    if (_stagingFences[slot]) {
+        glDeleteSync(_stagingFences[slot]);
+        _stagingFences[slot] = nullptr;
+    }
+
+    _freeStagingSlots.push_back(slot);
+}
+
+/**
+ * @brief TexturePool::beginStaging Binds the staging buffer of a slot as
+ *                                  the unpack buffer
+ * @param slot
+ * @return Where to copy the data to
+ */
+unsigned char* TexturePool::beginStaging(int slot)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _stagingBuffers[slot]);
+
+    if (_persistentMapping)
+        return _stagingPointers[slot];
+
+    /* The slot is only handed out again once its last upload completed,
+     * so there is no need to synchronize the mapping */
+    return (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _stagingSlotSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+/**
+ * @brief TexturePool::endStaging Unmaps the bound staging buffer if needed
+ */
+void TexturePool::endStaging()
+{
+    if (!_persistentMapping)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+/**
+ * @brief TexturePool::uploadHeightmap
+ * @param layer
+ * @param data RGB heights
+ * @param width
+ * @param height
+ * @param slot Staging slot to upload from, or -1 to upload from client
+ *             memory
+ * @return Whether the data fits the layers
+ */
+bool TexturePool::uploadHeightmap(int layer, const unsigned char* data, int width, int height, int slot)
+{
+    if (width != LAYER_SIZE || height != LAYER_SIZE) {
+        std::cerr << "Heightmap of size " << width << "x" << height << " does not fit the texture pool" << std::endl;
+        return false;
+    }
+
+    const unsigned char* source = data;
+
+    if (slot >= 0) {
+        std::memcpy(beginStaging(slot), data, LAYER_SIZE * LAYER_SIZE * 3);
+        endStaging();
+        source = nullptr; /* Offset into the unpack buffer */
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _heightmapArrayId);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, LAYER_SIZE, LAYER_SIZE, 1, GL_RGB, GL_UNSIGNED_BYTE, source);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (slot >= 0) {
+        _stagingFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    Util::checkGlError("HEIGHT LOAD FAILED");
+    return true;
+}
+
+/**
+ * @brief TexturePool::uploadOverlay
+ * @param layer
+ * @param data RGB overlay
+ * @param mipmaps The levels below the base level packed after each other,
+ *                see LoadWorkerThread::generateMipmaps
+ * @param width
+ * @param height
+ * @param slot Staging slot to upload from, or -1 to upload from client
+ *             memory
+ * @return Whether the data fits the layers
+ */
+bool TexturePool::uploadOverlay(int layer, const unsigned char* data, const unsigned char* mipmaps, int width, int height, int slot)
+{
+    if (width != LAYER_SIZE || height != LAYER_SIZE || mipmaps == nullptr) {
+        std::cerr << "Overlay of size " << width << "x" << height << " does not fit the texture pool" << std::endl;
+        return false;
+    }
+
+    std::size_t baseSize = LAYER_SIZE * LAYER_SIZE * 3;
+
+    /* Stage the base level and the mip levels after each other, the
+     * pointers then become offsets into the unpack buffer */
+    if (slot >= 0) {
+        unsigned char* staging = beginStaging(slot);
+        std::memcpy(staging, data, baseSize);
+        std::memcpy(staging + baseSize, mipmaps, mipmapsSize());
+        endStaging();
+
+        data = nullptr;
+        mipmaps = reinterpret_cast<const unsigned char*>(baseSize);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _overlayArrayId);
+
+    /* The rows of the smallest levels are not 4 byte aligned */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, LAYER_SIZE, LAYER_SIZE, 1, GL_RGB, GL_UNSIGNED_BYTE, data);
+
+    unsigned size = LAYER_SIZE / 2;
+    for (unsigned level = 1; level < numberOfMipmapLevels(); level++) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size, size, 1, GL_RGB, GL_UNSIGNED_BYTE, mipmaps);
+        mipmaps += size * size * 3;
+        size /= 2;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (slot >= 0) {
+        _stagingFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    Util::checkGlError("OVERLAY LOAD FAILED");
+    return true;
+}
+
+/**
+ * @brief TexturePool::numberOfMipmapLevels
+ * @return Number of levels of the overlay array, including the base level
+ */
+unsigned TexturePool::numberOfMipmapLevels()
+{
+    unsigned levels = 1;
+    for (unsigned size = LAYER_SIZE; size > 1; size /= 2)
+        levels++;
+    return levels;
+}
+
+/**
+ * @brief TexturePool::mipmapsSize
+ * @return Size in bytes of the overlay levels below the base level
+ */
+std::size_t TexturePool::mipmapsSize()
+{
+    std::size_t size = 0;
+    for (unsigned levelSize = LAYER_SIZE / 2; levelSize >= 1; levelSize /= 2)
+        size += levelSize * levelSize * 3;
+    return size;
+}
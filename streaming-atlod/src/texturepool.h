@@ -0,0 +1,61 @@
+#ifndef TEXTUREPOOL_H
+#define TEXTUREPOOL_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Heightmap and overlay texture arrays with one layer per node.
+ *
+ * All layers are allocated up front, nodes lease a layer while they are in
+ * the memory cache. The overlay array is mipmapped, the mip levels are
+ * generated on the load workers, since glGenerateMipmap would regenerate
+ * the whole array.
+ *
+ * Uploads go through a ring of pixel buffer objects, so that the driver does
+ * not have to copy from client memory before glTexSubImage3D returns. A
+ * fence per staging slot tells when an upload has completed. The buffers
+ * are persistently mapped if ARB_buffer_storage is available.
+ */
+class TexturePool {
+public:
+    static constexpr unsigned LAYER_SIZE = 512;
+    static constexpr unsigned STAGING_SLOTS = 16;
+
+    TexturePool(unsigned capacity);
+    void load();
+    void unload();
+
+    int acquire();
+    void release(int layer);
+
+    int acquireStagingSlot();
+    bool stagingSlotDone(int slot);
+    void releaseStagingSlot(int slot);
+
+    bool uploadHeightmap(int layer, const unsigned char* data, int width, int height, int slot);
+    bool uploadOverlay(int layer, const unsigned char* data, const unsigned char* mipmaps, int width, int height, int slot);
+
+    static unsigned numberOfMipmapLevels();
+    static std::size_t mipmapsSize();
+
+    // private:
+    unsigned char* beginStaging(int slot);
+    void endStaging();
+
+    unsigned _capacity;
+    unsigned _heightmapArrayId = 0, _overlayArrayId = 0;
+    std::vector<int> _freeLayers;
+
+    bool _persistentMapping = false;
+    std::size_t _stagingSlotSize;
+    unsigned _stagingBuffers[STAGING_SLOTS];
+    unsigned char* _stagingPointers[STAGING_SLOTS] = {};
+    GLsync _stagingFences[STAGING_SLOTS] = {};
+    std::vector<int> _freeStagingSlots;
+};
+
+#endif // TEXTUREPOOL_H
@@ -1,51 +1,109 @@
 #ifndef XYZTILEKEY_H
 #define XYZTILEKEY_H
 
+#include <cstdint>
 #include <functional>
 #include <string>
 
 /**
  * @brief The XYZTileKey class
+ *
+ * The key is packed into a single 64 bit integer:
+ * - Bits 58 to 63: zoom level z
+ * - Bits 29 to 57: x
+ * - Bits 0 to 28: y
+ *
+ * This allows zoom levels up to 29, which is well beyond what the tile
+ * services provide.
  */
 class XYZTileKey
 {
 public:
-    XYZTileKey(unsigned x, unsigned y, unsigned z);
-    XYZTileKey(std::string str);
+    constexpr XYZTileKey()
+        : _packed(0)
+    {
+    }
+
+    constexpr XYZTileKey(unsigned x, unsigned y, unsigned z)
+        : _packed(((uint64_t)z << Z_SHIFT) | (((uint64_t)x & COORD_MASK) << X_SHIFT) | ((uint64_t)y & COORD_MASK))
+    {
+    }
+
+    explicit XYZTileKey(std::string str);
+
+    std::string string() const;
+
+    constexpr bool operator==(const XYZTileKey& other) const
+    {
+        return _packed == other._packed;
+    }
+
+    constexpr bool operator!=(const XYZTileKey& other) const
+    {
+        return _packed != other._packed;
+    }
 
-    std::string string();
-    bool operator==(const XYZTileKey& other) const;
-    bool operator!=(const XYZTileKey& other) const;
-    XYZTileKey topLeftChild() const;
-    XYZTileKey topRightChild() const;
-    XYZTileKey bottomLeftChild() const;
-    XYZTileKey bottomRightChild() const;
+    /**
+     * @brief child
+     * @param quadrant 0: top left, 1: top right, 2: bottom left, 3: bottom right
+     * @return
+     */
+    constexpr XYZTileKey child(unsigned quadrant) const
+    {
+        return XYZTileKey(x() * 2 + (quadrant & 1), y() * 2 + (quadrant >> 1), z() + 1);
+    }
 
-    unsigned x() const;
-    unsigned y() const;
-    unsigned z() const;
+    constexpr XYZTileKey topLeftChild() const { return child(0); }
+    constexpr XYZTileKey topRightChild() const { return child(1); }
+    constexpr XYZTileKey bottomLeftChild() const { return child(2); }
+    constexpr XYZTileKey bottomRightChild() const { return child(3); }
+
+    /**
+     * @brief parent Must not be called on the root key
+     * @return
+     */
+    constexpr XYZTileKey parent() const
+    {
+        return XYZTileKey(x() / 2, y() / 2, z() - 1);
+    }
+
+    /**
+     * @brief quadrant
+     * @return The quadrant of this key inside its parent, see child()
+     */
+    constexpr unsigned quadrant() const
+    {
+        return (x() & 1) | ((y() & 1) << 1);
+    }
+
+    constexpr unsigned x() const { return (unsigned)((_packed >> X_SHIFT) & COORD_MASK); }
+    constexpr unsigned y() const { return (unsigned)(_packed & COORD_MASK); }
+    constexpr unsigned z() const { return (unsigned)(_packed >> Z_SHIFT); }
+
+    constexpr uint64_t packed() const { return _packed; }
 
 private:
-    unsigned _x, _y, _z;
+    static constexpr unsigned X_SHIFT = 29;
+    static constexpr unsigned Z_SHIFT = 58;
+    static constexpr uint64_t COORD_MASK = (1ULL << 29) - 1;
+
+    uint64_t _packed;
 };
 
 /**
  * Hash function injection
  *
- * Based on:
- * - https://en.cppreference.com/w/cpp/utility/hash
- * - https://stackoverflow.com/questions/17016175/c-unordered-map-using-a-custom-class-type-as-the-key
- * - http://stackoverflow.com/a/1646913/126995
+ * Uses the SplitMix64 finalizer on the packed key, so that neighbouring
+ * tiles spread over the whole hash range.
  */
 template <>
 struct std::hash<XYZTileKey> {
     std::size_t operator()(const XYZTileKey& k) const
     {
-        std::size_t res = 17;
-        res = res * 31 + hash<unsigned>()(k.x());
-        res = res * 31 + hash<unsigned>()(k.y());
-        res = res * 31 + hash<unsigned>()(k.z());
-        return res;
+        uint64_t h = k.packed();
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return (std::size_t)(h ^ (h >> 31));
     }
 };
 